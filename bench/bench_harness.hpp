@@ -0,0 +1,93 @@
+#ifndef BENCH_HARNESS_HPP
+#define BENCH_HARNESS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+//minimal benchmark harness, results are collected and written as a single JSON document so
+// they can be diffed/compared by tooling (progress goes to stderr)
+
+struct BenchResult {
+  BenchResult(std::string name) : name(std::move(name)) {}
+
+  std::string name;
+  //free-form parameters (message size, thread counts, policy, ...)
+  std::vector<std::pair<std::string, std::string>> params;
+  std::uint64_t iterations = 0;
+  double ns_per_op = 0;
+  //set if an op processes a known number of bytes
+  std::optional<double> bytes_per_sec;
+  //additional benchmark specific numbers (e.g. dropped items)
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+class BenchRunner {
+  public:
+    BenchRunner(std::optional<std::string> filter, std::chrono::milliseconds min_time) :
+      filter_(std::move(filter)),
+      min_time_(min_time) {}
+
+    bool selected(std::string const & name) const {
+      return !filter_.has_value() || name.find(*filter_) != std::string::npos;
+    }
+
+    //runs func with doubling iteration counts until a run takes at least min_time
+    template <typename FuncT>
+    BenchResult measure(std::string const & name, FuncT && func) const {
+      auto result = BenchResult(name);
+      for (auto iterations = std::uint64_t{1}; true; iterations *= 2) {
+        auto const start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 0; i < iterations; ++i)
+          func();
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed >= min_time_ || iterations >= max_iterations) {
+          result.iterations = iterations;
+          result.ns_per_op =
+            std::chrono::duration<double, std::nano>(elapsed).count() /
+            static_cast<double>(iterations);
+          return result;
+        }
+      }
+    }
+
+    void add(BenchResult && result) {
+      std::cerr << result.name;
+      for (auto const & [key, value] : result.params)
+        std::cerr << ' ' << key << '=' << value;
+      std::cerr << ": " << result.ns_per_op << " ns/op" << std::endl;
+      results_.push_back(std::move(result));
+    }
+
+    void write_json(std::ostream & out) const {
+      out << "{\n  \"benchmarks\": [";
+      for (size_t i = 0; i < results_.size(); ++i) {
+        auto const & result = results_[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name << "\", \"params\": {";
+        for (size_t j = 0; j < result.params.size(); ++j)
+          out << (j == 0 ? "" : ", ")
+            << '"' << result.params[j].first << "\": \"" << result.params[j].second << '"';
+        out << "}, \"iterations\": " << result.iterations
+          << ", \"ns_per_op\": " << result.ns_per_op;
+        if (result.bytes_per_sec.has_value())
+          out << ", \"bytes_per_sec\": " << *result.bytes_per_sec;
+        for (auto const & [key, value] : result.counters)
+          out << ", \"" << key << "\": " << value;
+        out << '}';
+      }
+      out << "\n  ]\n}" << std::endl;
+    }
+
+  private:
+    auto static constexpr max_iterations = std::uint64_t{1} << 30;
+
+    std::optional<std::string> filter_;
+    std::chrono::milliseconds min_time_;
+    std::vector<BenchResult> results_;
+};
+
+#endif
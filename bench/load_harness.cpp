@@ -0,0 +1,127 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_service.hpp"
+#include "key_service.hpp"
+#include "message_generator.hpp"
+#include "metrics.hpp"
+#include "record_types.hpp"
+
+//end-to-end load test of the CPU-bound part of the pipeline: a synthetic in-memory source feeds
+// BatchService/KeyService as fast as they accept records and a null sink only takes
+// measurements, so sqlite is out of the picture
+//usage: signing_load [records] [signing_threads] [batch_size] [pareto_shape] [max_message_bytes]
+
+namespace {
+  struct LoadOptions {
+    size_t records = 1'000'000;
+    size_t signing_threads = 4;
+    size_t batch_size = 100;
+    double pareto_shape = 1.0;
+    double max_message_bytes = 1 << 20;
+    //distinct messages generated up front and cycled through, so generation isn't measured
+    size_t message_pool = 10'000;
+    size_t source_chunk_size = 25;
+  };
+
+  LoadOptions parse_options(int argc, char ** argv) {
+    auto options = LoadOptions();
+    if (argc > 1) options.records = std::stoull(argv[1]);
+    if (argc > 2) options.signing_threads = std::stoull(argv[2]);
+    if (argc > 3) options.batch_size = std::stoull(argv[3]);
+    if (argc > 4) options.pareto_shape = std::stod(argv[4]);
+    if (argc > 5) options.max_message_bytes = std::stod(argv[5]);
+    return options;
+  }
+}
+
+int main(int argc, char ** argv) {
+  try {
+    using Clock = std::chrono::steady_clock;
+    auto const options = parse_options(argc, argv);
+
+    auto generator = MessageGenerator(0, options.pareto_shape, options.max_message_bytes);
+    auto messages = std::vector<std::string>();
+    for (size_t i = 0; i < options.message_pool; ++i)
+      messages.push_back(generator.next());
+
+    //indexed by record id, written by the source before a record is handed over
+    auto created = std::vector<Clock::time_point>(options.records);
+    auto latency = Histogram();
+    auto records_signed = std::atomic<size_t>(0);
+    auto bytes_signed = std::atomic<size_t>(0);
+
+    //every signing thread holds a key lease while it signs a batch
+    auto key_service = KeyService(options.signing_threads);
+    auto batch_service = BatchService(options.batch_size, options.signing_threads);
+    batch_service.start(
+      [&](std::stop_token, SignedBatch && signed_batch) {
+        auto const now = Clock::now();
+        auto bytes = size_t{0};
+        for (auto const & signed_record : signed_batch.records) {
+          auto const index = static_cast<size_t>(signed_record.id);
+          latency.record(now - created[index]);
+          bytes += messages[index % messages.size()].size();
+        }
+        bytes_signed.fetch_add(bytes, std::memory_order_relaxed);
+        records_signed.fetch_add(signed_batch.records.size(), std::memory_order_release);
+      },
+      key_service,
+      std::numeric_limits<size_t>::max()
+    );
+
+    auto const start = Clock::now();
+    auto source = std::jthread([&](std::stop_token stop) {
+      auto chunk = std::vector<Record>();
+      for (size_t i = 0; i < options.records && !stop.stop_requested(); ++i) {
+        created[i] = Clock::now();
+        chunk.push_back(Record{
+          static_cast<int>(i),
+          messages[i % messages.size()],
+          false,
+          i,
+          0
+        });
+        if (chunk.size() == options.source_chunk_size || i + 1 == options.records) {
+          batch_service.put(stop, std::move(chunk));
+          chunk = std::vector<Record>();
+        }
+      }
+    });
+
+    source.join();
+    batch_service.close();
+    batch_service.join();
+    auto const elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto const snapshot = latency.snapshot();
+    auto const records = static_cast<double>(records_signed.load());
+    auto const to_us = [](std::uint64_t ns) {return static_cast<double>(ns) / 1e3;};
+    std::cout
+      << "{\n"
+      << "  \"records\": " << records_signed.load() << ",\n"
+      << "  \"signing_threads\": " << options.signing_threads << ",\n"
+      << "  \"batch_size\": " << options.batch_size << ",\n"
+      << "  \"pareto_shape\": " << options.pareto_shape << ",\n"
+      << "  \"max_message_bytes\": " << options.max_message_bytes << ",\n"
+      << "  \"seconds\": " << elapsed << ",\n"
+      << "  \"records_per_sec\": " << records / elapsed << ",\n"
+      << "  \"bytes_per_sec\": " << static_cast<double>(bytes_signed.load()) / elapsed << ",\n"
+      << "  \"latency_p50_us\": " << to_us(snapshot.quantile(0.5)) << ",\n"
+      << "  \"latency_p99_us\": " << to_us(snapshot.quantile(0.99)) << ",\n"
+      << "  \"latency_p999_us\": " << to_us(snapshot.quantile(0.999)) << ",\n"
+      << "  \"latency_max_us\": " << to_us(snapshot.max) << "\n"
+      << "}" << std::endl;
+  }
+  catch (std::exception const & e) {
+    std::cout << "caught fatal exception: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,355 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <latch>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/filters.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/hex.h>
+
+#include "bench_harness.hpp"
+#include "hex.hpp"
+#include "key.hpp"
+#include "key_service.hpp"
+#include "merkle.hpp"
+#include "ring_buffer_queue.hpp"
+#include "sink_service.hpp"
+#include "threadsafe_queue.hpp"
+
+//microbenchmarks of the hot paths: signing/verification (per record and per merkle root), queues,
+// sink commits and key leasing
+//usage: signing_bench [name filter] > results.json
+
+namespace {
+  auto constexpr min_time = std::chrono::milliseconds(200);
+
+  std::string pipeline_sign(CryptoPP::ed25519::Signer const & signer, std::string const & message) {
+    auto signature_blob = std::string();
+    CryptoPP::StringSource(
+      message,
+      true,
+      new CryptoPP::SignerFilter(
+        CryptoPP::NullRNG(),
+        signer,
+        new CryptoPP::StringSink(signature_blob)
+      )
+    );
+    auto signature = std::string();
+    auto encoder = CryptoPP::HexEncoder(new CryptoPP::StringSink(signature));
+    CryptoPP::StringSource(signature_blob, true, new CryptoPP::Redirector(encoder));
+    return signature;
+  }
+
+  void bench_sign(BenchRunner & runner) {
+    auto key_service = KeyService(1);
+    auto key = key_service.acquire_key();
+    auto sink = size_t{0}; //keeps results alive
+
+    //32B up to 100MB
+    for (auto const message_bytes : {
+      size_t{32},
+      size_t{256},
+      size_t{2048},
+      size_t{64} << 10,
+      size_t{2} << 20,
+      size_t{64} << 20,
+      size_t{100'000'000}
+    }) {
+      auto const message = std::string(message_bytes, 'A');
+      auto const params = std::vector<std::pair<std::string, std::string>>{
+        {"message_bytes", std::to_string(message_bytes)}
+      };
+      auto signature = Signature();
+
+      if (runner.selected("key_sign")) {
+        auto result = runner.measure("key_sign", [&]() {
+          key.sign(std::string_view(message), signature);
+          sink += static_cast<size_t>(signature[0]);
+        });
+        result.params = params;
+        result.bytes_per_sec = static_cast<double>(message_bytes) / result.ns_per_op * 1e9;
+        runner.add(std::move(result));
+      }
+
+      if (runner.selected("key_verify")) {
+        key.sign(std::string_view(message), signature);
+        auto result = runner.measure("key_verify", [&]() {
+          sink += key.verify(std::string_view(message), signature);
+        });
+        result.params = params;
+        result.bytes_per_sec = static_cast<double>(message_bytes) / result.ns_per_op * 1e9;
+        runner.add(std::move(result));
+      }
+    }
+
+    //the CryptoPP filter pipeline Key::sign used to be, for reference
+    if (runner.selected("pipeline_sign")) {
+      auto prng = CryptoPP::AutoSeededRandomPool();
+      auto signer = CryptoPP::ed25519::Signer();
+      signer.AccessPrivateKey().GenerateRandom(prng);
+      for (auto message_bytes : {size_t{32}, size_t{256}, size_t{1024}}) {
+        auto const message = std::string(message_bytes, 'A');
+        auto result = runner.measure("pipeline_sign", [&]() {
+          sink += pipeline_sign(signer, message).size();
+        });
+        result.params = {{"message_bytes", std::to_string(message_bytes)}};
+        runner.add(std::move(result));
+      }
+    }
+
+    //a whole batch of small messages, one signature per record vs one per merkle root (time per
+    // record is reported)
+    if (runner.selected("batch_sign")) {
+      auto constexpr message_bytes = size_t{64};
+      for (auto batch_size : {size_t{1}, size_t{10}, size_t{100}, size_t{1000}}) {
+        auto const messages = std::vector<std::string>(batch_size, std::string(message_bytes, 'A'));
+        auto signatures = std::vector<Signature>(batch_size);
+        auto tree = std::vector<MerkleHash>();
+        auto const record = [&](BenchResult && result, std::string const & mode) {
+          result.params = {
+            {"mode", mode},
+            {"batch_size", std::to_string(batch_size)},
+            {"message_bytes", std::to_string(message_bytes)}
+          };
+          result.iterations *= batch_size;
+          result.ns_per_op /= static_cast<double>(batch_size);
+          runner.add(std::move(result));
+        };
+
+        record(runner.measure("batch_sign", [&]() {
+          for (size_t i = 0; i < batch_size; ++i)
+            key.sign(std::string_view(messages[i]), signatures[i]);
+          sink += static_cast<size_t>(signatures.back()[0]);
+        }), "per_record");
+
+        record(runner.measure("batch_sign", [&]() {
+          tree.clear();
+          for (auto const & message : messages)
+            tree.push_back(merkle_leaf_hash(message, false));
+          merkle_build(tree);
+          key.sign_merkle_root(tree.back(), static_cast<std::uint32_t>(batch_size), signatures[0]);
+          sink += static_cast<size_t>(signatures[0][0]);
+        }), "merkle");
+      }
+    }
+
+    std::cerr << "(" << sink % 2 << ")" << std::endl;
+  }
+
+  //producers offer items_per_producer items each while consumers drain the queue, the time per
+  // offered item is reported
+  template <typename QueueT>
+  BenchResult bench_queue(
+    std::string const & name,
+    std::string const & policy,
+    size_t producers,
+    size_t consumers,
+    size_t capacity,
+    size_t items_per_producer
+  ) {
+    auto queue = QueueT(capacity);
+    auto delivered = std::atomic<size_t>(0);
+    //all threads are running before the clock starts
+    auto ready = std::latch(static_cast<std::ptrdiff_t>(producers + consumers + 1));
+    auto start = std::chrono::steady_clock::time_point();
+
+    auto consumer_threads = std::vector<std::jthread>();
+    for (size_t c = 0; c < consumers; ++c)
+      consumer_threads.emplace_back([&](std::stop_token stop) {
+        ready.arrive_and_wait();
+        try {
+          while (true) {
+            queue.pop(stop);
+            delivered.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+        catch (StopRequested const &) {}
+      });
+    {
+      auto producer_threads = std::vector<std::jthread>();
+      for (size_t p = 0; p < producers; ++p)
+        producer_threads.emplace_back([&]() {
+          ready.arrive_and_wait();
+          for (size_t i = 0; i < items_per_producer; ++i) {
+            try {
+              queue.push(size_t{i});
+            }
+            catch (OutOfCapacity const &) {} //counted as not delivered
+          }
+        });
+      ready.arrive_and_wait();
+      start = std::chrono::steady_clock::now();
+    }
+    while (!queue.empty())
+      std::this_thread::yield();
+    for (auto & consumer : consumer_threads)
+      consumer.request_stop();
+    consumer_threads.clear();
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+
+    auto const offered = producers * items_per_producer;
+    auto result = BenchResult(name);
+    result.params = {
+      {"policy", policy},
+      {"producers", std::to_string(producers)},
+      {"consumers", std::to_string(consumers)},
+      {"capacity", std::to_string(capacity)}
+    };
+    result.iterations = offered;
+    result.ns_per_op =
+      std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(offered);
+    //discarding policies drop silently, everything not delivered was dropped
+    result.counters = {
+      {"delivered", static_cast<double>(delivered.load())},
+      {"dropped", static_cast<double>(offered - delivered.load())}
+    };
+    return result;
+  }
+
+  void bench_queues(BenchRunner & runner) {
+    auto constexpr capacity = size_t{1024};
+    auto constexpr items_per_producer = size_t{200'000};
+    auto constexpr thread_counts = std::array{size_t{1}, size_t{2}, size_t{4}};
+
+    for (auto producers : thread_counts) {
+      for (auto consumers : thread_counts) {
+        auto run = [&]<typename QueueT>(std::string const & name, std::string const & policy) {
+          if (runner.selected(name))
+            runner.add(bench_queue<QueueT>(
+              name, policy, producers, consumers, capacity, items_per_producer
+            ));
+        };
+        run.operator()<ThreadsafeQueue<size_t, WaitUntilCapacityAvailable>>("threadsafe_queue", "wait");
+        run.operator()<ThreadsafeQueue<size_t, DiscardOnNoCapacity>>("threadsafe_queue", "discard");
+        run.operator()<ThreadsafeQueue<size_t, ThrowOnNoCapacity>>("threadsafe_queue", "throw");
+        run.operator()<RingBufferQueue<size_t, WaitUntilCapacityAvailable>>("ring_buffer_queue", "wait");
+        run.operator()<RingBufferQueue<size_t, DiscardOnNoCapacity>>("ring_buffer_queue", "discard");
+        run.operator()<RingBufferQueue<size_t, ThrowOnNoCapacity>>("ring_buffer_queue", "throw");
+      }
+    }
+
+    if (runner.selected("ring_buffer_queue")) {
+      using SpscQueue =
+        RingBufferQueue<size_t, WaitUntilCapacityAvailable, SingleProducerSingleConsumer>;
+      runner.add(bench_queue<SpscQueue>(
+        "ring_buffer_queue", "wait_spsc", 1, 1, capacity, items_per_producer
+      ));
+    }
+  }
+
+  //rows per second through SinkService (queue, group commit, sqlite) for a given batch size
+  void bench_sink(BenchRunner & runner) {
+    if (!runner.selected("sink_commit"))
+      return;
+
+    auto constexpr total_rows = 20'000;
+    auto constexpr poll_interval = std::chrono::milliseconds(1);
+    auto const dbfile = (std::filesystem::temp_directory_path() / "signing_bench_sink.db").string();
+    auto key_service = KeyService(1);
+
+    for (auto batch_size : {1, 10, 100, 1000}) {
+      for (auto const & suffix : {"", "-wal", "-shm"})
+        std::filesystem::remove(dbfile + suffix);
+
+      auto sink_service = SinkService(
+        dbfile,
+        64,
+        SinkService::Options{.mode = SinkService::Mode::insert, .format = SinkService::Format::binary}
+      );
+      auto constexpr lowest = std::numeric_limits<int64_t>::min();
+      auto constexpr highest = std::numeric_limits<int64_t>::max();
+      sink_service.start(key_service, ShardRanges{IdRange{lowest, highest}}, std::numeric_limits<size_t>::max());
+
+      auto const start = std::chrono::steady_clock::now();
+      auto stop = std::stop_source();
+      for (int first = 1; first <= total_rows; first += batch_size) {
+        auto batch = SignedBatch();
+        batch.sequence = static_cast<size_t>((first - 1) / batch_size);
+        auto const last = std::min(first + batch_size - 1, total_rows);
+        for (auto id = first; id <= last; ++id)
+          batch.records.push_back(SignedRecord{id, 0, Signature()});
+        batch.progress.push_back(SourceProgress{
+          0,
+          static_cast<size_t>(first - 1),
+          static_cast<size_t>(last - 1),
+          last
+        });
+        sink_service.put(stop.get_token(), std::move(batch));
+      }
+      //the checkpoint is committed together with the last rows
+      while (true) {
+        auto const checkpoint = sink_service.checkpoint();
+        if (!checkpoint.empty() && checkpoint.front().after_id == total_rows)
+          break;
+        std::this_thread::sleep_for(poll_interval);
+      }
+      auto const elapsed = std::chrono::steady_clock::now() - start;
+      sink_service.blocking_stop();
+
+      auto result = BenchResult("sink_commit");
+      result.params = {{"batch_size", std::to_string(batch_size)}};
+      result.iterations = total_rows;
+      result.ns_per_op =
+        std::chrono::duration<double, std::nano>(elapsed).count() / total_rows;
+      runner.add(std::move(result));
+    }
+
+    for (auto const & suffix : {"", "-wal", "-shm"})
+      std::filesystem::remove(dbfile + suffix);
+  }
+
+  //acquire/release round trips with threads competing for the key pool
+  void bench_key_leasing(BenchRunner & runner) {
+    if (!runner.selected("key_lease"))
+      return;
+
+    auto constexpr leases_per_thread = size_t{100'000};
+    auto constexpr configs = std::array<std::pair<size_t, size_t>, 6>{{
+      {1, 1}, {2, 2}, {4, 4}, {8, 8}, //uncontended: one key per thread
+      {4, 2}, {8, 2} //oversubscribed: surplus threads block in acquire_key
+    }};
+    for (auto [threads, keys] : configs) {
+      auto key_service = KeyService(keys);
+      auto const start = std::chrono::steady_clock::now();
+      {
+        auto workers = std::vector<std::jthread>();
+        for (size_t t = 0; t < threads; ++t)
+          workers.emplace_back([&]() {
+            for (size_t i = 0; i < leases_per_thread; ++i)
+              key_service.acquire_key();
+          });
+      }
+      auto const elapsed = std::chrono::steady_clock::now() - start;
+
+      auto result = BenchResult("key_lease");
+      result.params = {{"threads", std::to_string(threads)}, {"keys", std::to_string(keys)}};
+      result.iterations = threads * leases_per_thread;
+      result.ns_per_op =
+        std::chrono::duration<double, std::nano>(elapsed).count() /
+        static_cast<double>(result.iterations);
+      runner.add(std::move(result));
+    }
+  }
+}
+
+int main(int argc, char ** argv) {
+  auto runner = BenchRunner(
+    argc > 1 ? std::optional<std::string>(argv[1]) : std::nullopt,
+    min_time
+  );
+
+  bench_sign(runner);
+  bench_queues(runner);
+  bench_sink(runner);
+  bench_key_leasing(runner);
+
+  runner.write_json(std::cout);
+  return EXIT_SUCCESS;
+}
@@ -1,18 +1,40 @@
 #include "batch_service.hpp"
 
+#include <algorithm>
+
 #include "key.hpp"
 #include "key_service.hpp"
+#include "merkle.hpp"
+
+auto constexpr default_batch_bytes = size_t{16} << 20;
 
 BatchService::BatchService(
   size_t batch_size,
   size_t signing_threads
+) : BatchService(batch_size, default_batch_bytes, signing_threads) {
+}
+
+BatchService::BatchService(
+  size_t batch_size,
+  size_t batch_bytes,
+  size_t signing_threads,
+  Mode mode
 ) : batch_size_(batch_size),
     signing_threads_(signing_threads),
-    record_queue_(batch_size * signing_threads) {
+    batch_bytes_(batch_bytes),
+    mode_(mode),
+    record_queue_(batch_size * signing_threads, batch_bytes * signing_threads),
+    batches_signed_(0),
+    pools_(std::make_shared<BufferPools>()) {
+}
+
+void BatchService::put(std::stop_token stop, std::vector<Record> && records) {
+  record_queue_.push_n(stop, records.begin(), records.end());
+  pools_->records.release(std::move(records));
 }
 
-void BatchService::put(std::stop_token stop, Record && record) {
-  record_queue_.push(stop, std::move(record));
+void BatchService::close() {
+  record_queue_.close();
 }
 
 void BatchService::start(
@@ -21,7 +43,8 @@ void BatchService::start(
   size_t log_frequency
 ) {
   using namespace std::placeholders;
-  start_thread(
+  start_threads(
+    signing_threads_,
     std::bind(&BatchService::work_loop, this, _1, _2, _3, _4),
     std::move(cb),
     std::ref(key_service),
@@ -29,48 +52,153 @@ void BatchService::start(
   );
 }
 
+void BatchService::register_metrics(MetricsRegistry & registry) {
+  registry.add("batch_records_in", metrics_.records_in);
+  registry.add("batch_bytes_in", metrics_.bytes_in);
+  registry.add("batch_records_out", metrics_.records_out);
+  registry.add("batch_sign_latency_ns", metrics_.sign_latency);
+  registry.add("batch_root_sign_latency_ns", metrics_.root_sign_latency);
+  registry.add(
+    "batch_record_queue_depth",
+    [this]() {return static_cast<std::int64_t>(record_queue_.size());}
+  );
+  registry.add(
+    "batch_record_queue_bytes",
+    [this]() {return static_cast<std::int64_t>(record_queue_.used());}
+  );
+}
+
+std::vector<Record> BatchService::fill_batch(std::stop_token stop, size_t & sequence) {
+  auto batch = pools_->records.acquire();
+  batch.reserve(batch_size_);
+  {
+    auto lock = std::scoped_lock(fill_mut_);
+    record_queue_.pop_n(stop, batch, batch_size_, std::nullopt, batch_bytes_);
+    sequence = next_batch_sequence_++;
+  }
+  auto bytes = size_t{0};
+  for (auto const & record : batch)
+    bytes += record.message.size();
+  metrics_.records_in.add(batch.size());
+  metrics_.bytes_in.add(bytes);
+  return batch;
+}
+
 void BatchService::work_loop(
   std::stop_token stop,
   SignedBatchCallback && cb,
   KeyService & key_service,
   size_t log_frequency
 ) {
-  //using namespace std::chrono_literals;
-  //std::this_thread::sleep_for(1s);
   log("BatchService: work_loop started");
   
   try {
-    for (size_t i = 1; !stop.stop_requested(); ++i) {
-      //fill batch
-      auto batch = std::vector<Record>();
-      batch.reserve(batch_size_);
-      for (size_t j = 0; j < batch_size_; ++j) {
-        auto record = record_queue_.pop(stop);
-        batch.emplace_back(std::move(record));
-      }
-      
-      //acquire key
-      auto key = key_service.acquire_key();
+    while (!stop.stop_requested()) {
+      auto sequence = size_t{0};
+      auto batch = fill_batch(stop, sequence);
       
-      //sign batch (move to separate thread)
-      auto signed_batch = SignedBatch();
-      signed_batch.reserve(batch_size_);
+      //sign batch
+      auto signed_batch = SignedBatch{
+        pools_->signed_records.acquire(),
+        pools_->progress.acquire(),
+        sequence
+      };
+      signed_batch.records.reserve(batch.size());
+      //batches are contiguous runs of the queue (see fill_batch) and every shard is a single
+      // producer, so the records of each shard in a batch are a contiguous run of its output
       for (auto const & record : batch) {
-        if (stop.stop_requested())
-          break;
-        signed_batch.emplace_back(record.id, key.get_public_key(), key.sign(record.message));
+        auto progress = std::find_if(
+          signed_batch.progress.begin(),
+          signed_batch.progress.end(),
+          [&](auto const & p) {return p.shard == record.shard;}
+        );
+        if (progress == signed_batch.progress.end())
+          signed_batch.progress.push_back(
+            SourceProgress{record.shard, record.sequence, record.sequence, record.id}
+          );
+        else {
+          progress->last_sequence = record.sequence;
+          progress->last_id = record.id;
+        }
+      }
+      {
+        //acquire key, waiting if all are leased, and release it before handing the batch on: the
+        // sink may block in ReorderBuffer::push until an earlier batch arrives, which could be
+        // waiting for this very key
+        auto key = key_service.acquire_key(stop);
+        if (mode_ == Mode::per_record) {
+          for (auto const & record : batch) {
+            if (stop.stop_requested())
+              break;
+            auto & signed_record =
+              signed_batch.records.emplace_back(record.id, key.get_signer_index(), Signature());
+            signed_record.prehashed = record.prehashed;
+            if (cache_ != nullptr && cache_->lookup(
+              record.message,
+              record.prehashed,
+              signed_record.signer,
+              signed_record.signature
+            ))
+              continue;
+            {
+              auto timer = ScopedTimer(metrics_.sign_latency);
+              if (record.prehashed)
+                key.sign_prehashed(record.message, signed_record.signature);
+              else
+                key.sign(record.message, signed_record.signature);
+            }
+            if (cache_ != nullptr)
+              cache_->insert(
+                record.message,
+                record.prehashed,
+                signed_record.signer,
+                signed_record.signature
+              );
+          }
+        }
+        else {
+          //n hashes and a single signature instead of n signatures
+          auto & tree = signed_batch.merkle_tree = pools_->merkle_trees.acquire();
+          tree.reserve(merkle_tree_size(batch.size()));
+          for (auto const & record : batch) {
+            auto timer = ScopedTimer(metrics_.sign_latency);
+            tree.push_back(merkle_leaf_hash(record.message, record.prehashed));
+          }
+          merkle_build(tree);
+          auto const leaf_count = static_cast<std::uint32_t>(batch.size());
+          auto root_signature = Signature();
+          {
+            auto timer = ScopedTimer(metrics_.root_sign_latency);
+            key.sign_merkle_root(tree.back(), leaf_count, root_signature);
+          }
+          for (std::uint32_t i = 0; i < leaf_count; ++i)
+            signed_batch.records.push_back(
+              SignedRecord{
+                batch[i].id,
+                key.get_signer_index(),
+                root_signature,
+                i,
+                leaf_count,
+                batch[i].prehashed
+              }
+            );
+        }
       }
 
       if (stop.stop_requested())
           break;
 
       //invoke callback
+      metrics_.records_out.add(signed_batch.records.size());
       cb(stop, std::move(signed_batch));
+      pools_->release_records(std::move(batch));
 
-      if (i % log_frequency == 0)
-        log("BatchService: signed " + std::to_string(i) + " batches");
+      auto const batches_signed = ++batches_signed_;
+      if (batches_signed % log_frequency == 0)
+        log("BatchService: signed {} batches", batches_signed);
     }
   }
   catch (StopRequested const &) {}
+  catch (QueueClosed const &) {}
   log("BatchService: work_loop ended");
 }
\ No newline at end of file
@@ -1,10 +1,18 @@
 #ifndef BATCH_SERVICE_HPP
 #define BATCH_SERVICE_HPP
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "buffer_pool.hpp"
 #include "common.hpp"
+#include "metrics.hpp"
 #include "microservice.hpp"
-#include "threadsafe_queue.hpp"
 #include "record_types.hpp"
+#include "ring_buffer_queue.hpp"
+#include "signature_cache.hpp"
 
 class KeyService;
 
@@ -12,13 +20,54 @@ class BatchService : public Microservice {
   public:
     using SignedBatchCallback = std::function<void (std::stop_token, SignedBatch)>;
 
+    enum class Mode {
+      per_record, //one signature per record
+      merkle      //one signature over the root of a merkle tree of the batch's records, every
+                  // record carries it along with its leaf position (see Key::verify_merkle)
+    };
+
+    //a batch is closed at batch_size records or batch_bytes (see Record::byte_size), whichever
+    // comes first, and the record queue holds at most one batch_size and one batch_bytes per
+    // signing thread
     BatchService(size_t batch_size, size_t signing_threads);
+    BatchService(
+      size_t batch_size,
+      size_t batch_bytes,
+      size_t signing_threads,
+      Mode mode = Mode::per_record
+    );
 
-    void put(std::stop_token stop, Record && record);
+    void put(std::stop_token stop, std::vector<Record> && records);
+    //end of stream: the remaining records are signed (the last batch may be partial), then the
+    // workers exit
+    void close();
 
+    //starts signing_threads workers that each fill, sign and forward their own batches
     void start(SignedBatchCallback && cb, KeyService & key_service, size_t log_frequency);
 
+    void register_metrics(MetricsRegistry & registry) override;
+
+    //recycles record vectors and message strings, takes signed batch vectors from the pools
+    void share_buffer_pools(std::shared_ptr<BufferPools> pools) {pools_ = std::move(pools);}
+
+    //per record mode only: duplicate messages reuse the signature (and signer) they got the first
+    // time instead of being signed again (none by default), must be called before start
+    void use_signature_cache(std::shared_ptr<SignatureCache> cache) {cache_ = std::move(cache);}
+
   private:
+    struct Metrics {
+      Counter records_in;
+      Counter bytes_in;
+      Counter records_out;
+      //per signed record (not cache hits, see SignatureCache metrics), in merkle mode only hashing
+      // the record
+      Histogram sign_latency;
+      Histogram root_sign_latency; //per batch, merkle mode only
+    };
+
+    //sequence is set to the position of the batch in the order batches are cut
+    std::vector<Record> fill_batch(std::stop_token stop, size_t & sequence);
+
     void work_loop(
       std::stop_token stop,
       SignedBatchCallback && cb,
@@ -28,7 +77,20 @@ class BatchService : public Microservice {
     
     size_t batch_size_;
     size_t signing_threads_;
-    ThreadsafeQueue<Record, WaitUntilCapacityAvailable> record_queue_;
+    size_t batch_bytes_;
+    Mode mode_;
+    //one producer per source shard, pops are serialized by fill_mut_
+    //byte-budgeted on top of its slots (a hard memory ceiling regardless of message sizes)
+    RingBufferQueue<Record, WaitUntilCapacityAvailable, MultiProducerMultiConsumer, CountBytes>
+      record_queue_;
+    //serializes batch filling so every batch holds a contiguous run of records
+    std::mutex fill_mut_;
+    //guarded by fill_mut_
+    size_t next_batch_sequence_ = 0;
+    std::atomic<size_t> batches_signed_;
+    Metrics metrics_;
+    std::shared_ptr<BufferPools> pools_;
+    std::shared_ptr<SignatureCache> cache_;
 };
 
 #endif
@@ -0,0 +1,105 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "metrics.hpp"
+#include "record_types.hpp"
+#include "ring_buffer_queue.hpp"
+
+//lock-free freelist of cleared containers (strings, vectors) that keeps their capacity, so a
+// consumer can hand buffers back to the producer instead of freeing them
+//buffers retaining more than max_retained_bytes are freed instead (a single fat-tailed message
+// mustn't pin its allocation forever), as are buffers released into a full pool
+template <typename T>
+class BufferPool {
+  public:
+    BufferPool(size_t max_buffers, size_t max_retained_bytes) :
+      max_retained_bytes_(max_retained_bytes),
+      free_(max_buffers) {}
+
+    //an empty buffer, with whatever capacity it was released with if it's recycled
+    T acquire() {
+      auto buffer = free_.try_pop();
+      if (!buffer.has_value()) {
+        misses_.add();
+        return T();
+      }
+      hits_.add();
+      return std::move(*buffer);
+    }
+
+    void release(T && buffer) {
+      //empty buffers (e.g. strings within their small buffer) aren't worth recycling
+      if (buffer.capacity() <= T().capacity())
+        return;
+      if (buffer.capacity() * sizeof(typename T::value_type) > max_retained_bytes_)
+        return;
+      buffer.clear();
+      free_.try_push(buffer);
+    }
+
+    void register_metrics(MetricsRegistry & registry, std::string const & name) {
+      registry.add(name + "_pool_hits", hits_);
+      registry.add(name + "_pool_misses", misses_);
+    }
+
+  private:
+    size_t max_retained_bytes_;
+    RingBufferQueue<T, DiscardOnNoCapacity, MultiProducerMultiConsumer> free_;
+    Counter hits_;
+    Counter misses_; //i.e. allocations
+};
+
+//the buffers that circulate through the pipeline:
+// source -> batcher: record vectors and message strings (released by the batcher once signed)
+// batcher -> sink: signed record, progress and merkle tree vectors (released by the sink once
+//  written)
+//every stage has its own pools by default, the stages only recycle each other's buffers once
+// they are handed the same instance (via share_buffer_pools, before they are started)
+struct BufferPools {
+  struct Limits {
+    size_t max_buffers = 1024;
+    size_t max_retained_message_bytes = size_t{64} << 10;
+    size_t max_retained_vector_bytes = size_t{1} << 20;
+  };
+
+  BufferPools() : BufferPools(Limits()) {}
+  BufferPools(Limits const & limits) :
+    messages(limits.max_buffers, limits.max_retained_message_bytes),
+    records(limits.max_buffers, limits.max_retained_vector_bytes),
+    signed_records(limits.max_buffers, limits.max_retained_vector_bytes),
+    progress(limits.max_buffers, limits.max_retained_vector_bytes),
+    merkle_trees(limits.max_buffers, limits.max_retained_vector_bytes) {}
+
+  void register_metrics(MetricsRegistry & registry) {
+    messages.register_metrics(registry, "message");
+    records.register_metrics(registry, "record_vector");
+    signed_records.register_metrics(registry, "signed_record_vector");
+    progress.register_metrics(registry, "progress_vector");
+    merkle_trees.register_metrics(registry, "merkle_tree_vector");
+  }
+
+  //releases the message strings as well
+  void release_records(std::vector<Record> && batch) {
+    for (auto & record : batch)
+      messages.release(std::move(record.message));
+    records.release(std::move(batch));
+  }
+
+  void release_signed_batch(SignedBatch && signed_batch) {
+    signed_records.release(std::move(signed_batch.records));
+    progress.release(std::move(signed_batch.progress));
+    merkle_trees.release(std::move(signed_batch.merkle_tree));
+  }
+
+  BufferPool<std::string> messages;
+  BufferPool<std::vector<Record>> records;
+  BufferPool<std::vector<SignedRecord>> signed_records;
+  BufferPool<std::vector<SourceProgress>> progress;
+  BufferPool<std::vector<MerkleHash>> merkle_trees;
+};
+
+#endif
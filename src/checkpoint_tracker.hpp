@@ -0,0 +1,36 @@
+#ifndef CHECKPOINT_TRACKER_HPP
+#define CHECKPOINT_TRACKER_HPP
+
+#include <map>
+#include <optional>
+
+#include "common.hpp"
+#include "record_types.hpp"
+
+//batches get committed out of order (multiple signing threads), so the checkpoint (the id up to
+// which every record a source shard emitted has been committed) can only be advanced once all
+// preceding sequence ranges of that shard have been committed too
+//one tracker per shard
+class CheckpointTracker {
+  public:
+    void add(SourceProgress const & progress) {
+      pending_.emplace(progress.first_sequence, progress);
+    }
+
+    //returns the new checkpoint if it advanced
+    std::optional<int> advance() {
+      auto checkpoint = std::optional<int>();
+      for (auto it = pending_.begin(); it != pending_.end() && it->first == next_sequence_;) {
+        next_sequence_ = it->second.last_sequence + 1;
+        checkpoint = it->second.last_id;
+        it = pending_.erase(it);
+      }
+      return checkpoint;
+    }
+
+  private:
+    size_t next_sequence_ = 0;
+    std::map<size_t, SourceProgress> pending_;
+};
+
+#endif
@@ -1,10 +1,20 @@
 #ifndef CRYPTO_SIZES_HPP
 #define CRYPTO_SIZES_HPP
 
+#include <array>
+#include <cstddef>
+
 #include "common.hpp"
 
 auto constexpr signature_bytes = size_t{64};
-auto constexpr public_key_bytes = size_t{44};
+auto constexpr public_key_bytes = size_t{44}; //X.509 SubjectPublicKeyInfo encoding
+auto constexpr raw_public_key_bytes = size_t{32};
 auto constexpr private_key_bytes = size_t{48};
+auto constexpr prehash_digest_bytes = size_t{64}; //SHA-512
+auto constexpr merkle_hash_bytes = size_t{32}; //SHA-256
+
+using Signature = std::array<std::byte, signature_bytes>;
+using RawPublicKey = std::array<std::byte, raw_public_key_bytes>;
+using MerkleHash = std::array<std::byte, merkle_hash_bytes>;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef HEX_HPP
+#define HEX_HPP
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "common.hpp"
+
+auto constexpr hex_digits_per_byte = size_t{2};
+
+struct InvalidHex : public virtual Exception {};
+
+//table based replacement for CryptoPP's HexEncoder/HexDecoder pipelines (same uppercase output)
+
+inline void to_hex(std::span<std::byte const> bytes, char * out) {
+  auto constexpr digits = std::string_view("0123456789ABCDEF");
+  for (auto byte : bytes) {
+    auto const value = static_cast<unsigned>(byte);
+    *out++ = digits[value >> 4];
+    *out++ = digits[value & 0xF];
+  }
+}
+
+inline std::string to_hex(std::span<std::byte const> bytes) {
+  auto hex = std::string(hex_digits_per_byte * bytes.size(), '\0');
+  to_hex(bytes, hex.data());
+  return hex;
+}
+
+//throws InvalidHex if hex isn't exactly 2*out.size() (case insensitive) hex digits
+inline void from_hex(std::string_view hex, std::span<std::byte> out) {
+  auto static constexpr invalid = std::uint8_t{0xFF};
+  auto static constexpr table = []() {
+    auto table = std::array<std::uint8_t, 256>();
+    table.fill(invalid);
+    for (auto i = 0; i < 10; ++i)
+      table['0' + i] = static_cast<std::uint8_t>(i);
+    for (auto i = 0; i < 6; ++i) {
+      table['A' + i] = static_cast<std::uint8_t>(10 + i);
+      table['a' + i] = static_cast<std::uint8_t>(10 + i);
+    }
+    return table;
+  }();
+
+  if (hex.size() != hex_digits_per_byte * out.size())
+    throw make_exception<InvalidHex>("unexpected hex length: " + std::to_string(hex.size()));
+
+  for (size_t i = 0; i < out.size(); ++i) {
+    auto const high = table[static_cast<unsigned char>(hex[2*i])];
+    auto const low = table[static_cast<unsigned char>(hex[2*i + 1])];
+    if (high == invalid || low == invalid)
+      throw make_exception<InvalidHex>("invalid hex digit at: " + std::to_string(2*i));
+    out[i] = static_cast<std::byte>(high << 4 | low);
+  }
+}
+
+#endif
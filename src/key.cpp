@@ -1,66 +1,123 @@
 #include "key.hpp"
 
+#include <algorithm>
+#include <utility>
+
 #include <cryptopp/cryptlib.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/osrng.h>
-#include <cryptopp/hex.h>
+#include <cryptopp/donna.h>
 
+#include "hex.hpp"
 #include "key_service.hpp"
 
+namespace {
+  CryptoPP::byte const * as_bytes(std::string_view message) {
+    return reinterpret_cast<CryptoPP::byte const *>(message.data());
+  }
+}
+
+Key::Key(Key && other) :
+    service_(other.service_),
+    index_(other.index_),
+    signer_(other.signer_),
+    leased_(std::exchange(other.leased_, false)) {
+}
+
 Key::~Key() {
-  if (!public_key_.empty()) //if Key hasn't been moved out of
-    service_.release_key(std::move(public_key_), std::move(signer_));
+  if (leased_)
+    service_.release_key(index_);
 }
 
 Key::Key(
   KeyService & service,
-  std::string && public_key,
-  CryptoPP::ed25519::Signer && signer
+  SignerIndex index,
+  CryptoPP::ed25519::Signer const & signer
 ) :
     service_(service),
-    public_key_(std::move(public_key)),
-    signer_(std::move(signer)) {
+    index_(index),
+    signer_(&signer),
+    leased_(true) {
 }
 
-std::string Key::sign(std::string const & message) const {
-  auto signature_blob = std::string();
-  CryptoPP::StringSource(
-    message,
-    true,
-    new CryptoPP::SignerFilter(
-      CryptoPP::NullRNG(),
-      signer_,
-      new CryptoPP::StringSink(signature_blob)
-    )
+std::string const & Key::get_public_key() const {
+  return service_.public_key(index_);
+}
+
+CryptoPP::ed25519PrivateKey const & Key::private_key() const {
+  return static_cast<CryptoPP::ed25519PrivateKey const &>(signer_->GetPrivateKey());
+}
+
+RawPublicKey Key::raw_public_key() const {
+  auto public_key = RawPublicKey();
+  auto const bytes = private_key().GetPublicKeyBytePtr();
+  std::transform(bytes, bytes + raw_public_key_bytes, public_key.begin(), [](auto b) {
+    return static_cast<std::byte>(b);
+  });
+  return public_key;
+}
+
+void Key::sign(std::string_view message, Signature & signature) const {
+  //same call that ed25519Signer makes internally, minus the message accumulator
+  auto const & key = private_key();
+  CryptoPP::Donna::ed25519_sign(
+    as_bytes(message),
+    message.size(),
+    key.GetPrivateKeyBytePtr(),
+    key.GetPublicKeyBytePtr(),
+    reinterpret_cast<CryptoPP::byte *>(signature.data())
   );
-  auto signature = std::string();
-  auto encoder = CryptoPP::HexEncoder(new CryptoPP::StringSink(signature));
-  CryptoPP::StringSource(signature_blob, true, new CryptoPP::Redirector(encoder));
-  //std::cout << "signature: " << encoder_str << " size: " << encoder_str.size() << std::endl;
-  return signature;
-};
+}
+
+bool Key::verify(std::string_view message, Signature const & signature) const {
+  return verify_signature(raw_public_key(), message, signature);
+}
+
+std::string Key::sign(std::string const & message) const {
+  auto signature = Signature();
+  sign(message, signature);
+  return to_hex(signature);
+}
 
 bool Key::verify(std::string const & message, std::string const & signature) const {
-  auto verifier = CryptoPP::ed25519::Verifier(signer_);
+  auto signature_blob = Signature();
+  try {
+    from_hex(signature, signature_blob);
+  }
+  catch (InvalidHex const &) {
+    return false;
+  }
+  return verify(std::string_view(message), signature_blob);
+}
 
-  std::string signature_blob;
-  CryptoPP::StringSource ss(
-    signature,
-    true,
-    new CryptoPP::HexDecoder(new CryptoPP::StringSink(signature_blob))
-  );
-  auto valid = false;
-  CryptoPP::StringSource(
-    signature_blob + message,
-    true,
-    new CryptoPP::SignatureVerificationFilter(
-      verifier,
-      new CryptoPP::ArraySink(
-        reinterpret_cast<CryptoPP::byte*>(&valid),
-        sizeof(valid)
-      )
-    )
-  );
+void Key::sign_prehashed(std::string_view digest, Signature & signature) const {
+  auto const message = prehashed_message(digest);
+  sign(std::string_view(message.data(), message.size()), signature);
+}
 
-  return valid;
-}
\ No newline at end of file
+bool Key::verify_prehashed(std::string_view digest, Signature const & signature) const {
+  return ::verify_prehashed(raw_public_key(), digest, signature);
+}
+
+void Key::sign_merkle_root(
+  MerkleHash const & root,
+  std::uint32_t leaf_count,
+  Signature & signature
+) const {
+  auto const message = merkle_root_message(root, leaf_count);
+  sign(std::string_view(message.data(), message.size()), signature);
+}
+
+bool Key::verify_merkle(
+  std::string_view message,
+  MerkleProof const & proof,
+  Signature const & root_signature
+) const {
+  return ::verify_merkle(raw_public_key(), message, false, proof, root_signature);
+}
+
+bool Key::verify_merkle_prehashed(
+  std::string_view digest,
+  MerkleProof const & proof,
+  Signature const & root_signature
+) const {
+  return ::verify_merkle(raw_public_key(), digest, true, proof, root_signature);
+}
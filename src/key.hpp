@@ -1,9 +1,15 @@
 #ifndef KEY_HPP
 #define KEY_HPP
 
+#include <string_view>
+
 #include <cryptopp/xed25519.h>
 
 #include "common.hpp"
+#include "crypto_sizes.hpp"
+#include "merkle.hpp"
+#include "record_types.hpp"
+#include "verify.hpp"
 
 class KeyService;
 
@@ -11,20 +17,53 @@ class Key {
   friend class KeyService;
 
   public:
-    Key(Key &&) = default;
+    Key(Key && other);
     ~Key();
 
-    std::string const & get_public_key() const {return public_key_;}
+    SignerIndex get_signer_index() const {return index_;}
+    std::string const & get_public_key() const;
+
+    //fast path: no allocations, no filter pipeline, raw signature
+    void sign(std::string_view message, Signature & signature) const;
+    bool verify(std::string_view message, Signature const & signature) const;
 
+    //hex encoded convenience wrappers
     std::string sign(std::string const & message) const;
     bool verify(std::string const & message, std::string const & signature) const;
 
+    //digest = SHA-512(message), see prehash_context
+    void sign_prehashed(std::string_view digest, Signature & signature) const;
+    bool verify_prehashed(std::string_view digest, Signature const & signature) const;
+
+    //one signature over the root of a batch's merkle tree covers all its records (see merkle.hpp)
+    void sign_merkle_root(
+      MerkleHash const & root,
+      std::uint32_t leaf_count,
+      Signature & signature
+    ) const;
+    //checks that message is included at proof.leaf_index in a tree whose root got root_signature
+    bool verify_merkle(
+      std::string_view message,
+      MerkleProof const & proof,
+      Signature const & root_signature
+    ) const;
+    bool verify_merkle_prehashed(
+      std::string_view digest,
+      MerkleProof const & proof,
+      Signature const & root_signature
+    ) const;
+
   private:
-    Key(KeyService & service, std::string && public_key, CryptoPP::ed25519::Signer && signer);
+    Key(KeyService & service, SignerIndex index, CryptoPP::ed25519::Signer const & signer);
+
+    CryptoPP::ed25519PrivateKey const & private_key() const;
+    RawPublicKey raw_public_key() const;
 
     KeyService & service_;
-    std::string public_key_;
-    CryptoPP::ed25519::Signer signer_;
+    SignerIndex index_;
+    //owned by the KeyService, exclusively ours while leased
+    CryptoPP::ed25519::Signer const * signer_;
+    bool leased_; //false once moved out of
 };
 
 #endif
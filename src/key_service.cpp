@@ -1,43 +1,147 @@
 #include "key_service.hpp"
 
+#include <functional>
+#include <limits>
+#include <thread>
+
 #include <cryptopp/cryptlib.h>
-#include <cryptopp/filters.h>
-#include <cryptopp/osrng.h>
-#include <cryptopp/hex.h>
-// #include <cryptopp/files.h>
 
+#include "hex.hpp"
 #include "key.hpp"
+#include "verify.hpp"
+
+std::atomic<uint64_t> KeyService::next_id_ = 0;
+
+namespace {
+  //the key this thread leased last, so that a worker keeps signing with the same signer (whose
+  // state is still in its caches) as long as no other thread took it in the meantime
+  struct AffinityHint {
+    uint64_t service_id = std::numeric_limits<uint64_t>::max();
+    SignerIndex index = 0;
+  };
+
+  thread_local auto affinity_hint = AffinityHint();
+}
 
 KeyService::KeyService(size_t key_count) {
-  auto prng = CryptoPP::AutoSeededRandomPool();
+  auto entries = generate_keys(key_count);
+  load_keys(entries);
+  wipe_keys(entries);
+}
 
-  for (size_t i = 0; i < key_count; ++i) {
-    //generate signer (~= private key)
-    auto signer = CryptoPP::ed25519::Signer();
-    signer.AccessPrivateKey().GenerateRandom(prng);
+KeyService::KeyService(std::string const & keystore_path, size_t key_count) {
+  //a keystore that already exists (or shows up meanwhile) is used as is
+  create_keystore(keystore_path, key_count);
+  auto const keystore = MappedKeystore(keystore_path);
+  if (keystore.entries().size() != key_count)
+    throw make_exception<InvalidKeystore>(
+      "keystore " + keystore_path + " holds " + std::to_string(keystore.entries().size()) +
+      " keys instead of " + std::to_string(key_count)
+    );
+  load_keys(keystore.entries());
+}
+
+//no key derivation: the signers are handed the stored public keys
+void KeyService::load_keys(std::span<KeystoreEntry const> entries) {
+  slots_ = std::make_unique<Slot[]>(entries.size());
+  public_keys_.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto const & entry = entries[i];
+    slots_[i].signer = CryptoPP::ed25519::Signer(
+      reinterpret_cast<CryptoPP::byte const *>(entry.public_key.data()),
+      reinterpret_cast<CryptoPP::byte const *>(entry.private_key.data())
+    );
+    public_keys_.emplace_back(to_hex(encode_public_key(entry.public_key)));
+  }
+}
+
+void KeyService::register_metrics(MetricsRegistry & registry) {
+  registry.add("key_acquire_wait_ns", acquire_wait_);
+}
+
+Key KeyService::acquire_key(std::stop_token stop) {
+  //without a deadline the only way to come back empty handed is a stop request, which throws
+  return std::move(*acquire_key(stop, std::nullopt));
+}
+
+std::optional<Key> KeyService::acquire_key(std::stop_token stop, Deadline deadline) {
+  auto const index = [&]() {
+    auto timer = ScopedTimer(acquire_wait_);
+    auto index = try_lease();
+    if (index.has_value())
+      return index;
+
+    //slow path: every key is leased, wait for a release
+    waiters_.fetch_add(1, std::memory_order_relaxed);
+    //pairs with the fence in release_key: either we see the released key or it sees our count
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+      auto lock = std::unique_lock(wait_mut_);
+      auto leased = [&]() {return (index = try_lease()).has_value();};
+      if (deadline.has_value())
+        wait_cond_.wait_until(lock, stop, *deadline, leased);
+      else
+        wait_cond_.wait(lock, stop, leased);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return index;
+  }();
+
+  if (!index.has_value()) {
+    if (stop.stop_requested())
+      throw make_exception<StopRequested>("");
+    return std::nullopt;
+  }
+  return make_key(*index);
+}
+
+std::optional<Key> KeyService::try_acquire_key() {
+  auto const index = try_lease();
+  if (!index.has_value())
+    return std::nullopt;
+  return make_key(*index);
+}
+
+bool KeyService::try_lease(SignerIndex index) {
+  auto & leased = slots_[index].leased;
+  //test before test-and-set so that scanning over leased keys doesn't steal their cache lines
+  return
+    !leased.load(std::memory_order_relaxed) &&
+    !leased.exchange(true, std::memory_order_acquire);
+}
 
-    //calculate public key
-    auto public_key = std::string();
-    auto encoder = CryptoPP::HexEncoder(new CryptoPP::StringSink(public_key));
-    auto verifier = CryptoPP::ed25519::Verifier(signer);
-    verifier.GetPublicKey().Save(encoder);
+std::optional<SignerIndex> KeyService::try_lease() {
+  auto const count = key_count();
+  if (count == 0)
+    return std::nullopt;
 
-    //store
-    key_queue_.emplace_back(std::move(public_key), std::move(signer));
+  //threads without a hint start at different keys so that they don't all race for the first one
+  auto const start = affinity_hint.service_id == id_
+    ? size_t{affinity_hint.index}
+    : std::hash<std::thread::id>()(std::this_thread::get_id()) % count;
+  for (size_t i = 0; i < count; ++i) {
+    auto const index = static_cast<SignerIndex>((start + i) % count);
+    if (try_lease(index)) {
+      affinity_hint = AffinityHint{id_, index};
+      return index;
+    }
   }
+  return std::nullopt;
 }
 
-Key KeyService::acquire_key() {
-  log("KeyService: acquired key: " + key_queue_.front().first);
-  auto lock = std::scoped_lock(mut_);
-  assert(!key_queue_.empty()); //we currently assume that there is more keys than worker threads
-  auto pair = std::move(key_queue_.front());
-  key_queue_.pop_front();
-  return Key{*this, std::move(pair.first), std::move(pair.second)};
+Key KeyService::make_key(SignerIndex index) {
+  log<LogLevel::debug>("KeyService: acquired key: {}", public_key(index));
+  return Key{*this, index, slots_[index].signer};
 }
 
-void KeyService::release_key(std::string && public_key, CryptoPP::ed25519::Signer && signer) {
-  log("KeyService: released key: " + public_key);
-  auto lock = std::scoped_lock(mut_);
-  key_queue_.emplace_back(std::move(public_key), std::move(signer));
+void KeyService::release_key(SignerIndex index) {
+  log<LogLevel::debug>("KeyService: released key: {}", public_key(index));
+  slots_[index].leased.store(false, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_relaxed) == 0)
+    return;
+  //taking the mutex orders us after a waiter that checked for a key but isn't asleep yet
+  //all waiters are woken since some of them may be leaving because of their stop token or deadline
+  { auto lock = std::scoped_lock(wait_mut_); }
+  wait_cond_.notify_all();
 }
@@ -1,13 +1,23 @@
 #ifndef KEY_SERVICE_HPP
 #define KEY_SERVICE_HPP
 
-#include <utility>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <vector>
 
 #include <cryptopp/xed25519.h>
 
 #include "common.hpp"
+#include "keystore.hpp"
+#include "metrics.hpp"
 #include "microservice.hpp"
+#include "record_types.hpp"
+#include "threadsafe_queue.hpp"
 
 class Key;
 
@@ -15,15 +25,53 @@ class KeyService : public Microservice {
   friend class Key;
 
   public:
+    //ephemeral keys, generated anew by every construction
     KeyService(size_t key_count);
+    //the keys of a keystore file (see keystore.hpp), which is created with key_count keys if it
+    // doesn't exist yet, throws InvalidKeystore if it holds a different number of keys
+    KeyService(std::string const & keystore_path, size_t key_count);
 
-    Key acquire_key();
+    //blocks until a key is free, throws StopRequested if stop is requested while waiting
+    Key acquire_key(std::stop_token stop = std::stop_token());
+    //additionally gives up once the deadline has passed
+    std::optional<Key> acquire_key(std::stop_token stop, Deadline deadline);
+    //never blocks
+    std::optional<Key> try_acquire_key();
+
+    //hex encoded public keys, immutable after construction
+    size_t key_count() const {return public_keys_.size();}
+    std::string const & public_key(SignerIndex index) const {return public_keys_[index];}
+
+    void register_metrics(MetricsRegistry & registry) override;
 
   private:
-    void release_key(std::string && public_key, CryptoPP::ed25519::Signer && signer);
+    //one cache line per key so that leasing one key doesn't contend with leasing its neighbours
+    struct alignas(64) Slot {
+      std::atomic<bool> leased = false;
+      CryptoPP::ed25519::Signer signer;
+    };
+
+    void load_keys(std::span<KeystoreEntry const> entries);
+
+    //lock-free: tries the calling thread's previous key first, then scans the other slots
+    std::optional<SignerIndex> try_lease();
+    bool try_lease(SignerIndex index);
+    Key make_key(SignerIndex index);
+    void release_key(SignerIndex index);
 
-    std::mutex mut_;
-    std::deque<std::pair<std::string, CryptoPP::ed25519::Signer>> key_queue_;
+    //distinguishes the thread-local affinity hints of different KeyService instances
+    static std::atomic<uint64_t> next_id_;
+    uint64_t const id_ = next_id_++;
+    std::vector<std::string> public_keys_;
+    //never resized after construction, so slots (and the signers they hold) don't move
+    std::unique_ptr<Slot[]> slots_;
+    //slow path only: acquirers that found every key leased wait here, release_key only takes the
+    // mutex when there are waiters
+    std::atomic<size_t> waiters_ = 0;
+    std::mutex wait_mut_;
+    std::condition_variable_any wait_cond_;
+    //time from calling acquire_key until a key is leased (or the caller gives up)
+    Histogram acquire_wait_;
 };
 
 #endif
@@ -0,0 +1,188 @@
+#include "keystore.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/donna.h>
+#include <cryptopp/misc.h>
+#include <cryptopp/osrng.h>
+
+namespace {
+  auto constexpr magic = std::string_view("SIGKEYS\x00", 8);
+  auto constexpr version = std::uint32_t{1};
+  auto constexpr header_bytes = magic.size() + 2 * sizeof(std::uint32_t);
+
+  void put_uint32(std::uint32_t value, char * out) {
+    for (auto shift = 0; shift < 32; shift += 8)
+      *out++ = static_cast<char>(value >> shift);
+  }
+
+  //handles short writes, throws on errors
+  void write_all(int fd, void const * data, size_t size, std::string const & path) {
+    auto bytes = static_cast<char const *>(data);
+    while (size > 0) {
+      auto const written = ::write(fd, bytes, size);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        throw make_exception<InvalidKeystore>(
+          "failed to write keystore: " + path + ": " + std::strerror(errno)
+        );
+      bytes += written;
+      size -= static_cast<size_t>(written);
+    }
+  }
+
+  //makes a rename within the directory durable
+  void sync_directory(std::filesystem::path const & directory) {
+    auto const fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || ::fsync(fd) != 0) {
+      auto const error = errno;
+      if (fd >= 0)
+        ::close(fd);
+      throw make_exception<InvalidKeystore>(
+        "failed to sync keystore directory: " + directory.string() + ": " + std::strerror(error)
+      );
+    }
+    ::close(fd);
+  }
+
+  std::uint32_t get_uint32(std::byte const * bytes) {
+    auto value = std::uint32_t{0};
+    for (auto i = 0; i < 4; ++i)
+      value |= static_cast<std::uint32_t>(bytes[i]) << (8 * i);
+    return value;
+  }
+}
+
+std::vector<KeystoreEntry> generate_keys(size_t key_count, size_t threads) {
+  if (threads == 0)
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  threads = std::min(threads, key_count);
+
+  auto entries = std::vector<KeystoreEntry>(key_count);
+  {
+    auto workers = std::vector<std::jthread>();
+    for (size_t t = 0; t < threads; ++t)
+      workers.emplace_back([&entries, t, threads]() {
+        auto prng = CryptoPP::AutoSeededRandomPool();
+        for (auto i = t; i < entries.size(); i += threads) {
+          auto & entry = entries[i];
+          auto const private_key = reinterpret_cast<CryptoPP::byte *>(entry.private_key.data());
+          prng.GenerateBlock(private_key, entry.private_key.size());
+          CryptoPP::Donna::ed25519_publickey(
+            reinterpret_cast<CryptoPP::byte *>(entry.public_key.data()),
+            private_key
+          );
+        }
+      });
+  }
+  return entries;
+}
+
+void wipe_keys(std::vector<KeystoreEntry> & entries) {
+  for (auto & entry : entries)
+    CryptoPP::SecureWipeArray(entry.private_key.data(), entry.private_key.size());
+  entries.clear();
+}
+
+bool create_keystore(std::string const & path, size_t key_count, size_t threads) {
+  if (std::filesystem::exists(path))
+    return false;
+
+  auto entries = generate_keys(key_count, threads);
+  auto header = std::array<char, header_bytes>();
+  std::copy(magic.begin(), magic.end(), header.begin());
+  put_uint32(version, header.data() + magic.size());
+  put_uint32(static_cast<std::uint32_t>(key_count), header.data() + magic.size() + 4);
+
+  //unique, so concurrent creators don't interfere, and owner-only from creation on, so nobody
+  // else can get hold of it before the keys are written
+  auto tmp_path = path + ".XXXXXX";
+  auto const fd = ::mkstemp(tmp_path.data());
+  if (fd < 0) {
+    wipe_keys(entries);
+    throw make_exception<InvalidKeystore>(
+      "failed to create keystore: " + tmp_path + ": " + std::strerror(errno)
+    );
+  }
+  try {
+    write_all(fd, header.data(), header.size(), tmp_path);
+    write_all(fd, entries.data(), entries.size() * sizeof(KeystoreEntry), tmp_path);
+    //durable before it's published, a crash must not leave a truncated keystore behind
+    if (::fsync(fd) != 0)
+      throw make_exception<InvalidKeystore>(
+        "failed to sync keystore: " + tmp_path + ": " + std::strerror(errno)
+      );
+    ::close(fd);
+  }
+  catch (...) {
+    ::close(fd);
+    wipe_keys(entries);
+    ::unlink(tmp_path.c_str());
+    throw;
+  }
+  wipe_keys(entries);
+
+  //unlike rename, link never replaces a keystore another process created meanwhile
+  auto const linked = ::link(tmp_path.c_str(), path.c_str()) == 0;
+  auto const error = errno;
+  ::unlink(tmp_path.c_str());
+  if (!linked && error != EEXIST)
+    throw make_exception<InvalidKeystore>(
+      "failed to publish keystore: " + path + ": " + std::strerror(error)
+    );
+  auto const directory = std::filesystem::path(path).parent_path();
+  sync_directory(directory.empty() ? std::filesystem::path(".") : directory);
+  return linked;
+}
+
+MappedKeystore::MappedKeystore(std::string const & path) {
+  auto const fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw make_exception<InvalidKeystore>("failed to open keystore: " + path);
+  struct stat info = {};
+  if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(header_bytes)) {
+    ::close(fd);
+    throw make_exception<InvalidKeystore>("keystore too short: " + path);
+  }
+  mapping_bytes_ = static_cast<size_t>(info.st_size);
+  mapping_ = ::mmap(nullptr, mapping_bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); //the mapping keeps the file referenced
+  if (mapping_ == MAP_FAILED) {
+    mapping_ = nullptr;
+    throw make_exception<InvalidKeystore>("failed to map keystore: " + path);
+  }
+
+  auto const bytes = static_cast<std::byte const *>(mapping_);
+  auto const key_count = get_uint32(bytes + magic.size() + sizeof(std::uint32_t));
+  auto const invalid = [&]() -> std::string {
+    if (!std::equal(magic.begin(), magic.end(), reinterpret_cast<char const *>(bytes)))
+      return "not a keystore";
+    if (get_uint32(bytes + magic.size()) != version)
+      return "unsupported keystore version";
+    if (mapping_bytes_ != header_bytes + key_count * sizeof(KeystoreEntry))
+      return "keystore size doesn't match its key count";
+    return {};
+  }();
+  if (!invalid.empty()) {
+    ::munmap(mapping_, mapping_bytes_);
+    throw make_exception<InvalidKeystore>(invalid + ": " + path);
+  }
+  entries_ = std::span(reinterpret_cast<KeystoreEntry const *>(bytes + header_bytes), key_count);
+}
+
+MappedKeystore::~MappedKeystore() {
+  if (mapping_ != nullptr)
+    ::munmap(mapping_, mapping_bytes_);
+}
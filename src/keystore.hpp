@@ -0,0 +1,55 @@
+#ifndef KEYSTORE_HPP
+#define KEYSTORE_HPP
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "crypto_sizes.hpp"
+
+//binary file of ed25519 key pairs so that the signer set is stable across runs and loading it
+// doesn't derive any public keys:
+// - header: magic, version and key count (little endian uint32s)
+// - entries: raw private key (seed) followed by the raw public key derived from it
+//the file holds private keys in the clear and is created readable by its owner only
+
+struct InvalidKeystore : public virtual Exception {};
+
+auto constexpr private_seed_bytes = size_t{32};
+
+struct KeystoreEntry {
+  std::array<std::byte, private_seed_bytes> private_key;
+  RawPublicKey public_key;
+};
+static_assert(sizeof(KeystoreEntry) == private_seed_bytes + raw_public_key_bytes);
+
+//spread over threads (0 = hardware concurrency) since deriving the public keys dominates
+std::vector<KeystoreEntry> generate_keys(size_t key_count, size_t threads = 0);
+
+//overwrites the entries' private keys before freeing them
+void wipe_keys(std::vector<KeystoreEntry> & entries);
+
+//writes a uniquely named temporary file next to path and hard links it into place, returns false
+// if path already exists (e.g. another process created it concurrently), leaving it untouched
+bool create_keystore(std::string const & path, size_t key_count, size_t threads = 0);
+
+//read-only memory mapping of a keystore file, validated on construction (throws InvalidKeystore)
+class MappedKeystore {
+  public:
+    MappedKeystore(std::string const & path);
+    ~MappedKeystore();
+    MappedKeystore(MappedKeystore const &) = delete;
+    MappedKeystore & operator=(MappedKeystore const &) = delete;
+
+    std::span<KeystoreEntry const> entries() const {return entries_;}
+
+  private:
+    void * mapping_ = nullptr;
+    size_t mapping_bytes_ = 0;
+    std::span<KeystoreEntry const> entries_;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "log_service.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string_view>
+
+namespace {
+  auto constexpr max_entries_per_drain = size_t{4096};
+
+  std::string_view level_name(LogLevel level) {
+    switch (level) {
+      case LogLevel::debug: return "DEBUG";
+      case LogLevel::info: return "INFO";
+      case LogLevel::warning: return "WARN";
+      case LogLevel::error: return "ERROR";
+    }
+    return "?";
+  }
+
+  void append_arg(std::string & line, LogArg const & arg) {
+    std::visit([&](auto const & value) {
+      using ValueType = std::decay_t<decltype(value)>;
+      if constexpr (std::is_same_v<ValueType, std::string>)
+        line += value;
+      else if constexpr (std::is_same_v<ValueType, bool>)
+        line += value ? "true" : "false";
+      else
+        line += std::to_string(value);
+    }, arg);
+  }
+
+  //"<UTC time of day> <level> <message>"
+  void format_entry(std::string & line, LogEntry const & entry) {
+    using namespace std::chrono;
+    auto const since_epoch = duration_cast<microseconds>(entry.time.time_since_epoch());
+    auto const time_of_day = hh_mm_ss(since_epoch % days(1));
+    char time[32];
+    std::snprintf(
+      time,
+      sizeof(time),
+      "%02d:%02d:%02d.%06d ",
+      static_cast<int>(time_of_day.hours().count()),
+      static_cast<int>(time_of_day.minutes().count()),
+      static_cast<int>(time_of_day.seconds().count()),
+      static_cast<int>(time_of_day.subseconds().count())
+    );
+    line += time;
+    line += level_name(entry.level);
+    line += ' ';
+
+    auto format = std::string_view(entry.format);
+    auto arg = size_t{0};
+    for (auto pos = format.find("{}"); pos != std::string_view::npos; pos = format.find("{}")) {
+      line += format.substr(0, pos);
+      if (arg < entry.arg_count)
+        append_arg(line, entry.args[arg++]);
+      format.remove_prefix(pos + 2);
+    }
+    line += format;
+    line += '\n';
+  }
+}
+
+LogService::LogService(
+  Logger & logger,
+  std::ostream & out
+) : logger_(logger),
+    out_(out) {
+}
+
+void LogService::start(std::chrono::milliseconds poll_interval) {
+  using namespace std::placeholders;
+  start_thread(std::bind(&LogService::work_loop, this, _1, _2), poll_interval);
+}
+
+size_t LogService::drain() {
+  auto const buffers = logger_.buffers();
+  reported_drops_.resize(buffers.size(), 0);
+
+  entries_.clear();
+  auto line = std::string();
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    auto & buffer = *buffers[i];
+    for (size_t n = 0; n < max_entries_per_drain; ++n) {
+      auto entry = buffer.entries.try_pop();
+      if (!entry.has_value())
+        break;
+      entries_.push_back(std::move(*entry));
+    }
+
+    auto const dropped = buffer.dropped.load(std::memory_order_relaxed);
+    if (dropped != reported_drops_[i]) {
+      line += "LogService: dropped " + std::to_string(dropped - reported_drops_[i]) +
+        " log entries of thread buffer " + std::to_string(i) + "\n";
+      reported_drops_[i] = dropped;
+    }
+  }
+
+  //buffers are drained one after the other, restore the order across threads
+  std::stable_sort(
+    entries_.begin(),
+    entries_.end(),
+    [](auto const & lhs, auto const & rhs) {return lhs.time < rhs.time;}
+  );
+  for (auto const & entry : entries_)
+    format_entry(line, entry);
+
+  if (!line.empty())
+    out_.write(line.data(), static_cast<std::streamsize>(line.size())).flush();
+  return entries_.size();
+}
+
+void LogService::work_loop(std::stop_token stop, std::chrono::milliseconds poll_interval) {
+  while (!stop.stop_requested())
+    if (drain() == 0)
+      std::this_thread::sleep_for(poll_interval);
+
+  //whatever got logged while the other services wound down
+  while (drain() != 0) {}
+}
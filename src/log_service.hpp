@@ -0,0 +1,34 @@
+#ifndef LOG_SERVICE_HPP
+#define LOG_SERVICE_HPP
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include "common.hpp"
+#include "logger.hpp"
+#include "microservice.hpp"
+
+//consumer of a Logger: drains all thread buffers, formats the entries and writes them out
+//a slow out only makes buffers fill up (and entries get dropped), it never stalls producers
+class LogService : public Microservice {
+  public:
+    LogService(Logger & logger, std::ostream & out);
+
+    //poll_interval is how long to sleep when all buffers were empty
+    void start(std::chrono::milliseconds poll_interval);
+
+  private:
+    void work_loop(std::stop_token stop, std::chrono::milliseconds poll_interval);
+
+    //returns the number of entries written
+    size_t drain();
+
+    Logger & logger_;
+    std::ostream & out_;
+    //drop counts already reported, indexed like Logger::buffers()
+    std::vector<size_t> reported_drops_;
+    std::vector<LogEntry> entries_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "common.hpp"
+#include "ring_buffer_queue.hpp"
+
+enum class LogLevel {debug, info, warning, error};
+
+//log calls below this level compile to nothing (override with -DLOG_MIN_LEVEL=0 for debug)
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 1
+#endif
+auto constexpr min_log_level = static_cast<LogLevel>(LOG_MIN_LEVEL);
+
+//arguments are captured by value and only formatted by the consumer (see LogService)
+using LogArg = std::variant<std::int64_t, std::uint64_t, double, bool, std::string>;
+
+struct LogEntry {
+  auto static constexpr max_args = size_t{4};
+
+  std::chrono::system_clock::time_point time;
+  LogLevel level;
+  //must be a string literal, every "{}" is replaced by the next argument
+  char const * format;
+  std::array<LogArg, max_args> args;
+  size_t arg_count;
+};
+
+template <typename T>
+LogArg to_log_arg(T const & value) {
+  if constexpr (std::is_same_v<T, bool>)
+    return value;
+  else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    return static_cast<std::int64_t>(value);
+  else if constexpr (std::is_integral_v<T>)
+    return static_cast<std::uint64_t>(value);
+  else if constexpr (std::is_floating_point_v<T>)
+    return static_cast<double>(value);
+  else
+    return std::string(std::string_view(value));
+}
+
+//front end of the asynchronous logger
+//every producing thread gets its own bounded SPSC buffer on first use, so logging never takes
+// a lock or waits: when a buffer is full the entry is dropped and counted instead
+class Logger {
+  public:
+    struct Buffer {
+      Buffer(size_t capacity) : entries(capacity), dropped(0) {}
+
+      RingBufferQueue<LogEntry, DiscardOnNoCapacity, SingleProducerSingleConsumer> entries;
+      std::atomic<size_t> dropped;
+    };
+
+    Logger(size_t buffer_capacity) :
+      id_(next_id_++),
+      buffer_capacity_(buffer_capacity) {}
+
+    template <LogLevel level, typename... ArgsT>
+    void log(char const * format, ArgsT const &... args) {
+      static_assert(sizeof...(ArgsT) <= LogEntry::max_args);
+      if constexpr (level >= min_log_level) {
+        auto entry = LogEntry{
+          std::chrono::system_clock::now(),
+          level,
+          format,
+          {to_log_arg(args)...},
+          sizeof...(ArgsT)
+        };
+        auto & buffer = thread_buffer();
+        if (!buffer.entries.try_push(entry))
+          buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    //snapshot of all buffers registered so far (for the consumer)
+    std::vector<Buffer *> buffers() const {
+      auto lock = std::scoped_lock(mut_);
+      auto buffers = std::vector<Buffer *>();
+      for (auto const & buffer : buffers_)
+        buffers.push_back(buffer.get());
+      return buffers;
+    }
+
+  private:
+    Buffer & thread_buffer() {
+      //keyed by id rather than address so a new logger at a reused address isn't confused with
+      // a destroyed one
+      thread_local auto cache = std::vector<std::pair<std::uint64_t, Buffer *>>();
+      for (auto const & [id, buffer] : cache)
+        if (id == id_)
+          return *buffer;
+
+      auto lock = std::scoped_lock(mut_);
+      auto & buffer = *buffers_.emplace_back(std::make_unique<Buffer>(buffer_capacity_));
+      cache.emplace_back(id_, &buffer);
+      return buffer;
+    }
+
+    inline static auto next_id_ = std::atomic<std::uint64_t>(0);
+
+    std::uint64_t id_;
+    size_t buffer_capacity_;
+    //only taken when a thread logs for the first time and by buffers()
+    mutable std::mutex mut_;
+    //buffers outlive their threads, the consumer drains whatever they still hold
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+#endif
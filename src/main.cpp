@@ -2,8 +2,13 @@
 #include <thread>
 #include <chrono>
 
+#include "buffer_pool.hpp"
 #include "record_types.hpp"
-#include "threadsafe_queue.hpp"
+#include "logger.hpp"
+#include "log_service.hpp"
+#include "metrics.hpp"
+#include "metrics_service.hpp"
+#include "signature_cache.hpp"
 #include "source_service.hpp"
 #include "key_service.hpp"
 #include "batch_service.hpp"
@@ -15,19 +20,45 @@ int main() {
     auto constexpr message_count = 1000;
     auto constexpr key_count = 10;
     auto constexpr batch_size = 100;
-    auto constexpr signing_threads = 1; //only supports one thread atm
+    //caps the time a batch holds a key and (per signing thread) the memory of queued records
+    auto constexpr batch_bytes = size_t{4} << 20;
+    auto constexpr source_chunk_size = 25;
+    auto constexpr source_shards = 4;
+    //every signing thread holds a key lease while it signs a batch, with more threads than keys
+    // the surplus threads wait in acquire_key
+    auto constexpr signing_threads = 4;
+    //merkle: one signature per batch plus an inclusion proof per record
+    auto constexpr signing_mode = BatchService::Mode::per_record;
+    //duplicate messages up to this size reuse their earlier signature instead of being re-signed
+    auto constexpr signature_cache_message_bytes = size_t{1024};
+    auto constexpr signature_cache_bytes = size_t{64} << 20;
     auto constexpr batch_log_frequency = 1;
+    //reorder window: signed batches this far ahead of the next one to be written block
     auto constexpr sink_queue_capacity = 10;
+    //larger messages are streamed into a SHA-512 digest which is signed instead
+    auto constexpr prehash_message_bytes = size_t{1} << 20;
 
-    auto log_queue =
-      ThreadsafeQueue<Microservice::LogLinePtr, WaitUntilCapacityAvailable>(1000);
-    auto push_log = [&log_queue](auto log_line) {
-      log_queue.push(Microservice::LogLinePtr{log_line}); //this is terrible
-    };
+    //entries per logging thread, overflowing entries are dropped (and counted)
+    auto constexpr log_buffer_capacity = 1024;
+    auto constexpr log_poll_interval = std::chrono::milliseconds(10);
+    auto constexpr metrics_interval = std::chrono::milliseconds(1000);
+
+    //declared before the services so it's still draining while they wind down
+    auto logger = Logger(log_buffer_capacity);
+    auto log_service = LogService(logger, std::cout);
+    log_service.start(log_poll_interval);
 
     auto services = std::vector<std::unique_ptr<Microservice>>();
 
-    services.emplace_back(std::make_unique<SourceService>("messages.db"));
+    //signatures are written back into messages.db, reruns only pick up unsigned messages
+    services.emplace_back(std::make_unique<SourceService>(
+      "messages.db",
+      SourceService::Options{
+        .prehash_message_bytes = prehash_message_bytes,
+        .skip_signed = true,
+        .shards = source_shards
+      }
+    ));
     auto source_service = dynamic_cast<SourceService*>(services.back().get());
 
     if (source_service->is_empty()) {
@@ -35,29 +66,57 @@ int main() {
       return EXIT_SUCCESS;
     }
 
-    services.emplace_back(std::make_unique<KeyService>(key_count));
+    //created on the first run, later runs sign with the same keys
+    services.emplace_back(std::make_unique<KeyService>("keystore.bin", key_count));
     auto key_service = dynamic_cast<KeyService*>(services.back().get());
 
-    services.emplace_back(std::make_unique<BatchService>(batch_size, signing_threads));
+    services.emplace_back(std::make_unique<BatchService>(
+      batch_size,
+      batch_bytes,
+      signing_threads,
+      signing_mode
+    ));
     auto batch_service = dynamic_cast<BatchService*>(services.back().get());
 
-    services.emplace_back(std::make_unique<SinkService>("signed.db", sink_queue_capacity));
+    services.emplace_back(std::make_unique<SinkService>(
+      "messages.db",
+      sink_queue_capacity,
+      SinkService::Options{
+        .mode = SinkService::Mode::update_messages,
+        .format = SinkService::Format::binary,
+        .resume = true
+      }
+    ));
     auto sink_service = dynamic_cast<SinkService*>(services.back().get());
 
-    auto log_thread = std::jthread([&log_queue](std::stop_token stop) {
-      try {
-        while (!stop.stop_requested()) {
-          auto log_line = log_queue.pop(stop);
-          std::cout << *log_line << std::endl;
-        }
-      }
-      catch (StopRequested const &) {}
+    auto metrics = MetricsRegistry();
+    for (auto & service : services) {
+      service->attach_logger(logger);
+      service->register_metrics(metrics);
+    }
+
+    //message strings and batch vectors are handed back upstream instead of being freed
+    auto buffer_pools = std::make_shared<BufferPools>();
+    buffer_pools->register_metrics(metrics);
+    source_service->share_buffer_pools(buffer_pools);
+    batch_service->share_buffer_pools(buffer_pools);
+    sink_service->share_buffer_pools(buffer_pools);
+
+    auto signature_cache = std::make_shared<SignatureCache>(SignatureCache::Options{
+      .max_bytes = signature_cache_bytes,
+      .max_message_bytes = signature_cache_message_bytes
     });
+    signature_cache->register_metrics(metrics);
+    batch_service->use_signature_cache(signature_cache);
+
+    auto metrics_service = MetricsService(metrics, "metrics.json", MetricsService::Format::json);
+    metrics_service.attach_logger(logger);
+    metrics_service.start(metrics_interval);
 
-    for (auto & service : services)
-      service->subscribe_logs(push_log);
+    //a resumed run keeps the shards of the interrupted one
+    auto const shards = source_service->plan_shards(sink_service->checkpoint());
 
-    sink_service->start(batch_log_frequency);
+    sink_service->start(*key_service, shards, batch_log_frequency);
 
     batch_service->start(
       [sink_service](std::stop_token stop, SignedBatch && signed_batch) {
@@ -68,20 +127,26 @@ int main() {
     );
 
     source_service->start(
-      [batch_service](std::stop_token stop, Record && record) {
-        batch_service->put(stop, std::move(record));
+      [batch_service](std::stop_token stop, std::vector<Record> && records) {
+        batch_service->put(stop, std::move(records));
       },
-      batch_size
+      source_chunk_size,
+      batch_size,
+      shards
     );
 
+    //drain the pipeline stage by stage: every stage is closed once its producers are done
     source_service->join();
-    using namespace std::chrono_literals;
-    std::this_thread::sleep_for(2s); //even more terrible
+    batch_service->close();
+    batch_service->join();
+    sink_service->close();
+    sink_service->join();
 
-    for (auto & service : services)
-      service->request_stop();
+    //writes a final snapshot, must be stopped before the services it samples are destroyed
+    metrics_service.blocking_stop();
     
     services.clear();
+    log_service.blocking_stop();
   }
   catch (std::exception const & e) {
     std::cout << "caught fatal exception: " << e.what() << std::endl;
@@ -0,0 +1,152 @@
+#include "merkle.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/sha.h>
+
+namespace {
+  enum class Domain : std::uint8_t {
+    leaf = 0x00,
+    node = 0x01,
+    prehashed_leaf = 0x02
+  };
+
+  void hash(
+    Domain domain,
+    std::span<std::byte const> first,
+    std::span<std::byte const> second,
+    MerkleHash & out
+  ) {
+    auto sha = CryptoPP::SHA256();
+    auto const prefix = static_cast<CryptoPP::byte>(domain);
+    sha.Update(&prefix, 1);
+    sha.Update(reinterpret_cast<CryptoPP::byte const *>(first.data()), first.size());
+    sha.Update(reinterpret_cast<CryptoPP::byte const *>(second.data()), second.size());
+    sha.Final(reinterpret_cast<CryptoPP::byte *>(out.data()));
+  }
+
+  MerkleHash node_hash(MerkleHash const & left, MerkleHash const & right) {
+    auto out = MerkleHash();
+    hash(Domain::node, left, right, out);
+    return out;
+  }
+
+  void put_uint32(std::uint32_t value, std::vector<std::byte> & out) {
+    for (auto shift = 0; shift < 32; shift += 8)
+      out.push_back(static_cast<std::byte>(value >> shift));
+  }
+
+  std::uint32_t get_uint32(std::span<std::byte const> bytes) {
+    auto value = std::uint32_t{0};
+    for (auto i = 0; i < 4; ++i)
+      value |= static_cast<std::uint32_t>(bytes[i]) << (8 * i);
+    return value;
+  }
+}
+
+MerkleHash merkle_leaf_hash(std::string_view message, bool prehashed) {
+  auto out = MerkleHash();
+  hash(
+    prehashed ? Domain::prehashed_leaf : Domain::leaf,
+    std::as_bytes(std::span(message)),
+    {},
+    out
+  );
+  return out;
+}
+
+size_t merkle_tree_size(size_t leaf_count) {
+  auto size = leaf_count;
+  for (auto level_size = leaf_count; level_size > 1; level_size = (level_size + 1) / 2)
+    size += (level_size + 1) / 2;
+  return size;
+}
+
+void merkle_build(std::vector<MerkleHash> & tree) {
+  auto level_begin = size_t{0};
+  auto level_size = tree.size();
+  //exact, so the pushes below never reallocate
+  tree.reserve(merkle_tree_size(level_size));
+  while (level_size > 1) {
+    for (size_t i = 0; i + 1 < level_size; i += 2)
+      tree.push_back(node_hash(tree[level_begin + i], tree[level_begin + i + 1]));
+    if (level_size % 2 != 0)
+      tree.push_back(tree[level_begin + level_size - 1]);
+    level_begin += level_size;
+    level_size = (level_size + 1) / 2;
+  }
+}
+
+void merkle_path(
+  std::span<MerkleHash const> tree,
+  std::uint32_t leaf_count,
+  std::uint32_t leaf_index,
+  std::vector<MerkleHash> & path
+) {
+  path.clear();
+  auto level_begin = size_t{0};
+  auto level_size = size_t{leaf_count};
+  auto index = size_t{leaf_index};
+  while (level_size > 1) {
+    if (auto const sibling = index ^ 1; sibling < level_size)
+      path.push_back(tree[level_begin + sibling]);
+    level_begin += level_size;
+    level_size = (level_size + 1) / 2;
+    index /= 2;
+  }
+}
+
+std::optional<MerkleHash> merkle_root(MerkleHash const & leaf, MerkleProof const & proof) {
+  if (proof.leaf_index >= proof.leaf_count)
+    return std::nullopt;
+
+  auto root = leaf;
+  auto next = proof.path.begin();
+  auto level_size = size_t{proof.leaf_count};
+  auto index = size_t{proof.leaf_index};
+  while (level_size > 1) {
+    //the last node of an odd level has no sibling and is carried up unchanged
+    if ((index ^ 1) < level_size) {
+      if (next == proof.path.end())
+        return std::nullopt;
+      root = index % 2 == 0 ? node_hash(root, *next) : node_hash(*next, root);
+      ++next;
+    }
+    level_size = (level_size + 1) / 2;
+    index /= 2;
+  }
+  if (next != proof.path.end())
+    return std::nullopt;
+  return root;
+}
+
+void encode_merkle_proof(
+  std::uint32_t leaf_index,
+  std::uint32_t leaf_count,
+  std::span<MerkleHash const> path,
+  std::vector<std::byte> & out
+) {
+  out.clear();
+  out.reserve(2 * sizeof(std::uint32_t) + path.size() * merkle_hash_bytes);
+  put_uint32(leaf_index, out);
+  put_uint32(leaf_count, out);
+  for (auto const & hash : path)
+    out.insert(out.end(), hash.begin(), hash.end());
+}
+
+MerkleProof decode_merkle_proof(std::span<std::byte const> encoded) {
+  auto constexpr header_bytes = 2 * sizeof(std::uint32_t);
+  if (encoded.size() < header_bytes || (encoded.size() - header_bytes) % merkle_hash_bytes != 0)
+    throw make_exception<InvalidMerkleProof>(
+      "unexpected merkle proof size: " + std::to_string(encoded.size())
+    );
+
+  auto proof = MerkleProof{get_uint32(encoded), get_uint32(encoded.subspan(4)), {}};
+  auto const hashes = encoded.subspan(header_bytes);
+  proof.path.resize(hashes.size() / merkle_hash_bytes);
+  for (size_t i = 0; i < proof.path.size(); ++i)
+    std::copy_n(hashes.begin() + i * merkle_hash_bytes, merkle_hash_bytes, proof.path[i].begin());
+  return proof;
+}
@@ -0,0 +1,57 @@
+#ifndef MERKLE_HPP
+#define MERKLE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "common.hpp"
+#include "crypto_sizes.hpp"
+
+//binary merkle trees over SHA-256 as in RFC 6962 (certificate transparency): leaves and inner
+// nodes are hashed in separate domains and an unpaired last node is carried up a level unchanged
+//a tree is stored flat, level by level: the leaves first, the root last
+
+struct InvalidMerkleProof : public virtual Exception {};
+
+//the position of a leaf in its tree and the sibling hashes from the leaf up to the root
+struct MerkleProof {
+  std::uint32_t leaf_index = 0;
+  std::uint32_t leaf_count = 0;
+  std::vector<MerkleHash> path;
+};
+
+//for prehashed records message is the SHA-512 digest, which gets a domain of its own so that a
+// message can't pass for the digest of another one
+MerkleHash merkle_leaf_hash(std::string_view message, bool prehashed);
+
+//number of nodes of a tree of leaf_count leaves, carried up nodes included (e.g. 11 for 5 leaves)
+size_t merkle_tree_size(size_t leaf_count);
+
+//tree holds the leaf hashes, the levels above them are appended
+void merkle_build(std::vector<MerkleHash> & tree);
+
+//tree must have been built from leaf_count leaves, path is overwritten
+void merkle_path(
+  std::span<MerkleHash const> tree,
+  std::uint32_t leaf_count,
+  std::uint32_t leaf_index,
+  std::vector<MerkleHash> & path
+);
+
+//the root the proof leads to from leaf, empty if the proof doesn't fit its leaf_count
+std::optional<MerkleHash> merkle_root(MerkleHash const & leaf, MerkleProof const & proof);
+
+//leaf_index and leaf_count as 4 byte little endian each, followed by the path
+void encode_merkle_proof(
+  std::uint32_t leaf_index,
+  std::uint32_t leaf_count,
+  std::span<MerkleHash const> path,
+  std::vector<std::byte> & out
+);
+//throws InvalidMerkleProof
+MerkleProof decode_merkle_proof(std::span<std::byte const> encoded);
+
+#endif
@@ -0,0 +1,73 @@
+#include "message_generator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "hex.hpp"
+
+namespace {
+  auto constexpr hex_digits_per_entropy = 2 * sizeof(std::uint64_t);
+
+  //turns the 16 nibbles of entropy into 16 uppercase hex digits without branching (SWAR)
+  //the digits come out in a different order than to_hex would produce, which doesn't matter
+  // for random data
+  void fill_hex(std::uint64_t entropy, char * out, size_t digits) {
+    auto constexpr low_nibbles = std::uint64_t{0x0F0F0F0F0F0F0F0F};
+    auto constexpr ones = std::uint64_t{0x0101010101010101};
+    for (auto nibbles : {entropy & low_nibbles, (entropy >> 4) & low_nibbles}) {
+      //every byte is in [0, 16), adding 6 carries into bit 4 exactly for the letters
+      auto const letters = ((nibbles + 6 * ones) >> 4) & ones;
+      auto const hex = nibbles + '0' * ones + ('A' - '0' - 10) * letters;
+      auto const bytes = std::min(digits, sizeof(hex));
+      std::memcpy(out, &hex, bytes);
+      out += bytes;
+      digits -= bytes;
+    }
+  }
+}
+
+//reality is fat-tailed and doesn't even owe you an expected value
+// (but we at least limit it to max_bytes)
+MessageGenerator::MessageGenerator(
+  std::uint64_t seed,
+  double shape,
+  double max_bytes
+) : max_bytes_(std::min(max_bytes, max_message_bytes)),
+    rng_(seed),
+    exp_distr_(shape) {
+}
+
+double MessageGenerator::sample_message_bytes() {
+  //see https://en.wikipedia.org/wiki/Pareto_distribution#Relation_to_the_exponential_distribution
+  auto res = std::exp(exp_distr_(rng_));
+  using ResultType = decltype(res);
+  return
+    res != std::numeric_limits<ResultType>::infinity()
+    ? res
+    : std::numeric_limits<ResultType>::max();
+}
+
+std::string MessageGenerator::next() {
+  //ensure that max_message_bytes can fit in EntropyType
+  using EntropyType = decltype(rng_());
+  static_assert(
+    static_cast<double>(max_message_bytes)
+    <=
+    static_cast<double>(std::numeric_limits<EntropyType>::max())
+  );
+  static_assert(sizeof(EntropyType) == sizeof(std::uint64_t));
+
+  //cap actual size using max_bytes_
+  //  (a static_cast from double to integer that overflows is undefined behavior)
+  auto const message_bytes = static_cast<EntropyType>(
+    std::min(sample_message_bytes(), max_bytes_)
+  );
+
+  auto message = std::string(hex_digits_per_byte * message_bytes, '\0'); //might throw
+  for (size_t i = 0; i < message.size(); i += hex_digits_per_entropy)
+    fill_hex(rng_(), message.data() + i, std::min(hex_digits_per_entropy, message.size() - i));
+
+  return message;
+}
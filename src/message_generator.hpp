@@ -0,0 +1,35 @@
+#ifndef MESSAGE_GENERATOR_HPP
+#define MESSAGE_GENERATOR_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "common.hpp"
+
+//generates random hex messages whose byte count (i.e. half their length) is pareto distributed
+//every generator owns its rng state, so one per thread can run in parallel and a given seed
+// always produces the same sequence of messages
+class MessageGenerator {
+  public:
+    //maximum entropy of a random message (about 100MB - sqlite has an upper limit of ~1GB)
+    auto static constexpr max_message_bytes = 1e8;
+
+    //shape is the pareto shape parameter (smaller is more fat-tailed), the minimum is 1 byte
+    MessageGenerator(
+      std::uint64_t seed,
+      double shape = 1.0,
+      double max_bytes = max_message_bytes
+    );
+
+    std::string next();
+
+  private:
+    double sample_message_bytes();
+
+    double max_bytes_;
+    std::mt19937_64 rng_;
+    std::exponential_distribution<> exp_distr_;
+};
+
+#endif
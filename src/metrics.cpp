@@ -0,0 +1,85 @@
+#include "metrics.hpp"
+
+namespace {
+  struct Quantile {
+    double q;
+    char const * json_name;
+    char const * prometheus_label;
+  };
+
+  auto constexpr quantiles = std::array{
+    Quantile{0.5, "p50", "0.5"},
+    Quantile{0.9, "p90", "0.9"},
+    Quantile{0.99, "p99", "0.99"},
+    Quantile{0.999, "p999", "0.999"}
+  };
+  auto constexpr prometheus_prefix = "signing_";
+}
+
+void MetricsRegistry::add(std::string const & name, Counter const & counter) {
+  auto lock = std::scoped_lock(mut_);
+  counters_.emplace_back(name, &counter);
+}
+
+void MetricsRegistry::add(std::string const & name, Histogram const & histogram) {
+  auto lock = std::scoped_lock(mut_);
+  histograms_.emplace_back(name, &histogram);
+}
+
+void MetricsRegistry::add(std::string const & name, Sampler && gauge) {
+  auto lock = std::scoped_lock(mut_);
+  gauges_.emplace_back(name, std::move(gauge));
+}
+
+void MetricsRegistry::write_json(std::ostream & out) const {
+  auto lock = std::scoped_lock(mut_);
+  auto separator = [&out](bool & first) {
+    out << (first ? "\n    " : ",\n    ");
+    first = false;
+  };
+
+  out << "{\n  \"counters\": {";
+  auto first = true;
+  for (auto const & [name, counter] : counters_) {
+    separator(first);
+    out << '"' << name << "\": " << counter->value();
+  }
+  out << "\n  },\n  \"gauges\": {";
+  first = true;
+  for (auto const & [name, gauge] : gauges_) {
+    separator(first);
+    out << '"' << name << "\": " << gauge();
+  }
+  out << "\n  },\n  \"histograms\": {";
+  first = true;
+  for (auto const & [name, histogram] : histograms_) {
+    auto const snapshot = histogram->snapshot();
+    separator(first);
+    out << '"' << name << "\": {\"count\": " << snapshot.count << ", \"sum\": " << snapshot.sum
+      << ", \"max\": " << snapshot.max;
+    for (auto const & quantile : quantiles)
+      out << ", \"" << quantile.json_name << "\": " << snapshot.quantile(quantile.q);
+    out << '}';
+  }
+  out << "\n  }\n}\n";
+}
+
+void MetricsRegistry::write_prometheus(std::ostream & out) const {
+  auto lock = std::scoped_lock(mut_);
+  for (auto const & [name, counter] : counters_)
+    out << "# TYPE " << prometheus_prefix << name << "_total counter\n"
+      << prometheus_prefix << name << "_total " << counter->value() << '\n';
+  for (auto const & [name, gauge] : gauges_)
+    out << "# TYPE " << prometheus_prefix << name << " gauge\n"
+      << prometheus_prefix << name << ' ' << gauge() << '\n';
+  //exported as summaries since quantiles are computed here anyway
+  for (auto const & [name, histogram] : histograms_) {
+    auto const snapshot = histogram->snapshot();
+    out << "# TYPE " << prometheus_prefix << name << " summary\n";
+    for (auto const & quantile : quantiles)
+      out << prometheus_prefix << name << "{quantile=\"" << quantile.prometheus_label << "\"} "
+        << snapshot.quantile(quantile.q) << '\n';
+    out << prometheus_prefix << name << "_sum " << snapshot.sum << '\n'
+      << prometheus_prefix << name << "_count " << snapshot.count << '\n';
+  }
+}
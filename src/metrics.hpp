@@ -0,0 +1,146 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+//all metrics are updated with relaxed atomics and never lock, a snapshot taken concurrently is
+// consistent per value but not across values
+
+class Counter {
+  public:
+    void add(std::uint64_t n = 1) {value_.fetch_add(n, std::memory_order_relaxed);}
+    std::uint64_t value() const {return value_.load(std::memory_order_relaxed);}
+
+  private:
+    //own cache line, counters are bumped from multiple threads
+    alignas(64) std::atomic<std::uint64_t> value_{0};
+};
+
+//log-linear buckets (like HdrHistogram): every power of two range is split into sub_buckets
+// linear buckets, so the relative error of a recorded value is at most 1/sub_buckets
+class Histogram {
+  public:
+    auto static constexpr sub_bucket_bits = 5;
+    auto static constexpr sub_buckets = std::uint64_t{1} << sub_bucket_bits;
+    auto static constexpr bucket_count =
+      sub_buckets + (64 - sub_bucket_bits) * sub_buckets;
+
+    struct Snapshot {
+      std::uint64_t count = 0;
+      std::uint64_t sum = 0;
+      std::uint64_t max = 0;
+      std::vector<std::uint64_t> buckets;
+
+      //upper bound of the bucket containing the q-th quantile (0 if empty)
+      std::uint64_t quantile(double q) const {
+        if (count == 0)
+          return 0;
+        auto const rank = static_cast<std::uint64_t>(q * static_cast<double>(count - 1)) + 1;
+        auto seen = std::uint64_t{0};
+        for (size_t i = 0; i < buckets.size(); ++i) {
+          seen += buckets[i];
+          if (seen >= rank)
+            return std::min(bucket_upper_bound(i), max);
+        }
+        return max;
+      }
+    };
+
+    void record(std::uint64_t value) {
+      buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+      count_.fetch_add(1, std::memory_order_relaxed);
+      sum_.fetch_add(value, std::memory_order_relaxed);
+      auto max = max_.load(std::memory_order_relaxed);
+      while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+    }
+
+    void record(std::chrono::steady_clock::duration duration) {
+      record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()
+      ));
+    }
+
+    Snapshot snapshot() const {
+      auto snapshot = Snapshot{
+        count_.load(std::memory_order_relaxed),
+        sum_.load(std::memory_order_relaxed),
+        max_.load(std::memory_order_relaxed),
+        std::vector<std::uint64_t>(bucket_count)
+      };
+      for (size_t i = 0; i < bucket_count; ++i)
+        snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+      return snapshot;
+    }
+
+    static size_t bucket_index(std::uint64_t value) {
+      if (value < sub_buckets)
+        return static_cast<size_t>(value);
+      auto const shift = static_cast<size_t>(std::bit_width(value)) - 1 - sub_bucket_bits;
+      return static_cast<size_t>(sub_buckets + shift * sub_buckets + (value >> shift) - sub_buckets);
+    }
+
+    static std::uint64_t bucket_upper_bound(size_t index) {
+      if (index < sub_buckets)
+        return index;
+      auto const shift = (index - sub_buckets) / sub_buckets;
+      auto const sub_bucket = sub_buckets + (index - sub_buckets) % sub_buckets;
+      return ((sub_bucket + 1) << shift) - 1;
+    }
+
+  private:
+    std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+//times a scope into a histogram
+class ScopedTimer {
+  public:
+    ScopedTimer(Histogram & histogram) :
+      histogram_(histogram),
+      start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {histogram_.record(std::chrono::steady_clock::now() - start_);}
+
+  private:
+    Histogram & histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+//names metrics owned elsewhere (typically by the services) for export
+//gauges are sampled via a callback (e.g. a queue's size()) whenever a snapshot is written
+class MetricsRegistry {
+  public:
+    using Sampler = std::function<std::int64_t ()>;
+
+    void add(std::string const & name, Counter const & counter);
+    void add(std::string const & name, Histogram const & histogram);
+    void add(std::string const & name, Sampler && gauge);
+
+    //histogram values are reported in their recorded unit (nanoseconds for durations)
+    void write_json(std::ostream & out) const;
+    void write_prometheus(std::ostream & out) const;
+
+  private:
+    //registration only happens during setup, the mutex merely guards against concurrent export
+    mutable std::mutex mut_;
+    std::vector<std::pair<std::string, Counter const *>> counters_;
+    std::vector<std::pair<std::string, Histogram const *>> histograms_;
+    std::vector<std::pair<std::string, Sampler>> gauges_;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "metrics_service.hpp"
+
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+MetricsService::MetricsService(
+  MetricsRegistry const & registry,
+  std::string const & path,
+  Format format
+) : registry_(registry),
+    path_(path),
+    format_(format) {
+}
+
+void MetricsService::start(std::chrono::milliseconds interval) {
+  using namespace std::placeholders;
+  start_thread(std::bind(&MetricsService::work_loop, this, _1, _2), interval);
+}
+
+void MetricsService::write_snapshot() {
+  auto const tmp_path = path_ + ".tmp";
+  {
+    auto out = std::ofstream(tmp_path, std::ios::trunc);
+    if (format_ == Format::json)
+      registry_.write_json(out);
+    else
+      registry_.write_prometheus(out);
+    if (!out.flush())
+      throw make_exception<Exception>("failed to write metrics snapshot: " + tmp_path);
+  }
+  std::filesystem::rename(tmp_path, path_);
+}
+
+void MetricsService::work_loop(std::stop_token stop, std::chrono::milliseconds interval) {
+  log("MetricsService: work_loop started");
+  auto mut = std::mutex();
+  auto cond = std::condition_variable_any();
+  while (!stop.stop_requested()) {
+    {
+      auto lock = std::unique_lock(mut);
+      //only wakes up early on stop
+      cond.wait_for(lock, stop, interval, []() {return false;});
+    }
+    try {
+      write_snapshot();
+    }
+    catch (std::exception const & e) {
+      log<LogLevel::warning>("MetricsService: {}", e.what());
+    }
+  }
+  log("MetricsService: work_loop ended");
+}
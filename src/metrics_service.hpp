@@ -0,0 +1,30 @@
+#ifndef METRICS_SERVICE_HPP
+#define METRICS_SERVICE_HPP
+
+#include <chrono>
+#include <string>
+
+#include "common.hpp"
+#include "metrics.hpp"
+#include "microservice.hpp"
+
+//periodically writes a snapshot of a MetricsRegistry to a file (replaced atomically, so readers
+// never see a partial snapshot), and once more when stopped
+class MetricsService : public Microservice {
+  public:
+    enum class Format {json, prometheus};
+
+    MetricsService(MetricsRegistry const & registry, std::string const & path, Format format);
+
+    void start(std::chrono::milliseconds interval);
+
+  private:
+    void work_loop(std::stop_token stop, std::chrono::milliseconds interval);
+    void write_snapshot();
+
+    MetricsRegistry const & registry_;
+    std::string path_;
+    Format format_;
+};
+
+#endif
@@ -1,28 +1,29 @@
 #include "microservice.hpp"
 
-void Microservice::log(std::string && logline) {
-  log_signal_(std::make_shared<std::string>(std::move(logline)));
-}
-
 void Microservice::request_stop() {
-  if (!thread_.has_value())
+  if (threads_.empty())
     throw make_exception<Exception>("not started");
   
-  thread_->request_stop();
+  for (auto & thread : threads_)
+    thread.request_stop();
 }
 
 void Microservice::blocking_stop() {
-  if (!thread_.has_value())
+  if (threads_.empty())
     throw make_exception<Exception>("not started");
   
-  thread_.reset(); //will automatically invoke stop token and join thread
+  //request stop on all threads first so they wind down concurrently
+  request_stop();
+  threads_.clear(); //jthread dtors join
 }
 
 void Microservice::join() {
-  if (!thread_.has_value())
+  if (threads_.empty())
     throw make_exception<Exception>("not started");
   
-  thread_->join();
+  for (auto & thread : threads_)
+    if (thread.joinable())
+      thread.join();
 }
 
 // void Microservice::start_thread(std::function<void (std::stop_token)> && work_loop) {
@@ -1,47 +1,67 @@
 #ifndef MICROSERVICE_HPP
 #define MICROSERVICE_HPP
 
+#include <functional>
 #include <memory>
-#include <optional>
 #include <thread>
-
-#include <boost/signals2.hpp>
+#include <vector>
 
 #include "common.hpp"
+#include "logger.hpp"
+
+class MetricsRegistry;
 
 class Microservice {
   public:
-    using LogLinePtr = std::shared_ptr<std::string>;
-
     virtual ~Microservice() {}
 
-    template <typename FuncT>
-    auto subscribe_logs(FuncT && cb) {return log_signal_.connect(cb);}
+    //logs are discarded until a logger is attached (must outlive the service)
+    void attach_logger(Logger & logger) {logger_ = &logger;}
+
+    //adds the service's own metrics (which it always updates) to registry for export
+    virtual void register_metrics(MetricsRegistry &) {}
 
     void request_stop();
     void blocking_stop();
     void join();
     
   protected:
-    void log(std::string && logline);
+    //format is a string literal with a "{}" per argument, formatting happens on the log thread
+    template <LogLevel level = LogLevel::info, typename... ArgsT>
+    void log(char const * format, ArgsT const &... args) {
+      if (logger_ != nullptr)
+        logger_->log<level>(format, args...);
+    }
 
     template<typename FuncT, typename... ArgsT>
     void start_thread(FuncT && work_loop, ArgsT &&... args);
+
+    //every thread gets its own copy of args and its own stop token
+    template<typename FuncT, typename... ArgsT>
+    void start_threads(size_t count, FuncT && work_loop, ArgsT &&... args);
   
   private:
-    using LogSignal = boost::signals2::signal<void (LogLinePtr const & logline)>;
-
-    std::optional<std::jthread> thread_;
-    LogSignal log_signal_;
+    std::vector<std::jthread> threads_;
+    Logger * logger_ = nullptr;
 };
 
 template<typename FuncT, typename... ArgsT>
 void Microservice::start_thread(FuncT && work_loop, ArgsT &&... args) {
-  if (thread_.has_value())
+  start_threads(1, work_loop, args...);
+}
+
+template<typename FuncT, typename... ArgsT>
+void Microservice::start_threads(size_t count, FuncT && work_loop, ArgsT &&... args) {
+  if (!threads_.empty())
     throw make_exception<Exception>("already started");
   
+  if (count == 0)
+    throw make_exception<Exception>("at least one thread required");
+  
   //TODO wrap work_loop in try-catch-all
-  thread_ = std::jthread(work_loop, args...);
+  threads_.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    threads_.emplace_back(work_loop, args...);
 }
 
 #endif
@@ -1,20 +1,68 @@
 #ifndef RECORD_TYPES_HPP
 #define RECORD_TYPES_HPP
 
+#include <cstdint>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "crypto_sizes.hpp"
+
+//index into the public key table of KeyService
+using SignerIndex = std::uint32_t;
+
 struct Record {
   int id;
+  //if prehashed, message holds the SHA-512 digest of the actual message instead
   std::string message;
+  bool prehashed = false;
+  //position in the order in which the source shard emitted its records
+  size_t sequence = 0;
+  size_t shard = 0;
+
+  //memory accounted for in byte-budgeted queues and batches (see CountBytes)
+  size_t byte_size() const {return sizeof(Record) + message.size();}
+};
+
+//ids in (after_id, end_id] belong to a shard, its index is its position in a ShardRanges vector
+struct IdRange {
+  int64_t after_id;
+  int64_t end_id;
 };
 
+using ShardRanges = std::vector<IdRange>;
+
+//fixed-size so that a SignedBatch is a single contiguous allocation
 struct SignedRecord {
   int id;
-  std::string signature;
-  std::string signer;
+  SignerIndex signer;
+  //in merkle mode the signature of the batch's merkle root
+  Signature signature;
+  //in merkle mode the position of the record among the leaves of the batch's merkle tree,
+  // leaf_count is 0 for records that were signed individually
+  std::uint32_t leaf_index = 0;
+  std::uint32_t leaf_count = 0;
+  //the signature (or merkle leaf) covers the digest of the message (see Record::prehashed), the
+  // sink stores it so the output can be verified without knowing the signing run's settings
+  bool prehashed = false;
+};
+static_assert(std::is_trivially_copyable_v<SignedRecord>);
+
+//the records [first_sequence, last_sequence] of a source shard, last_id belongs to last_sequence
+struct SourceProgress {
+  size_t shard;
+  size_t first_sequence;
+  size_t last_sequence;
+  int last_id;
 };
 
-using SignedBatch = std::vector<SignedRecord>;
+struct SignedBatch {
+  std::vector<SignedRecord> records;
+  std::vector<SourceProgress> progress;
+  //position in the order in which batches were cut from the record queue (see ReorderBuffer)
+  size_t sequence = 0;
+  //merkle mode only: the batch's tree (see merkle.hpp) from which the records' proofs are taken
+  std::vector<MerkleHash> merkle_tree = {};
+};
 
 #endif
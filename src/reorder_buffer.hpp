@@ -0,0 +1,176 @@
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <vector>
+
+#include "common.hpp"
+#include "threadsafe_queue.hpp"
+
+//a queue that releases items in ascending sequence order although they are pushed out of order
+// (e.g. batches completed by multiple signing threads)
+// - sequences are expected to be dense (0, 1, 2, ...), each pushed exactly once
+// - bounded window: a push blocks while its sequence is window or more ahead of the next one to
+//   be released, which also bounds the number of held items
+// - fallback: if nothing could be released for timeout although items are waiting, the missing
+//   sequences are skipped, they are released right away if they show up later (counted as late)
+// - close() signals end of stream: whatever is left is released in order regardless of gaps
+template <typename T>
+class ReorderBuffer {
+  using Clock = std::chrono::steady_clock;
+
+  public:
+    ReorderBuffer(size_t window, std::chrono::milliseconds timeout) :
+      window_(std::max(window, size_t{1})),
+      timeout_(timeout) {}
+    //implicit move/copy ctors/assignments rightfully implicitly deleted because of mutex member
+
+    //all pushes must have completed before close is called, pushing afterwards throws
+    void close() {
+      {
+        auto lock = std::scoped_lock{mut_};
+        closed_ = true;
+      }
+      cond_.notify_all();
+    }
+
+    void push(std::stop_token stop, size_t sequence, T && item) {
+      {
+        auto lock = std::unique_lock{mut_};
+        throw_if_closed();
+        cond_.wait(lock, stop, [&]() {return sequence < next_ + window_;});
+        if (stop.stop_requested())
+          return;
+        if (sequence < next_)
+          ++late_;
+        pending_.emplace(sequence, std::move(item));
+        if (!stalled_since_.has_value())
+          stalled_since_ = Clock::now();
+      }
+      cond_.notify_all();
+    }
+
+    //appends up to count items in sequence order to items
+    //same semantics as ThreadsafeQueue::pop_n: without a deadline it blocks until count items were
+    // popped, once closed and drained it returns what it got so far, or throws QueueClosed if
+    // that's nothing
+    size_t pop_n(
+      std::stop_token stop,
+      std::vector<T> & items,
+      size_t count,
+      Deadline deadline = std::nullopt
+    ) {
+      auto popped = size_t{0};
+      {
+        auto lock = std::unique_lock{mut_};
+        while (popped < count) {
+          if (releasable()) {
+            auto front = pending_.begin();
+            next_ = std::max(next_, front->first + 1);
+            items.emplace_back(std::move(front->second));
+            pending_.erase(front);
+            ++popped;
+            //progress: a remaining gap gets a fresh timeout
+            stalled_since_ = pending_.empty() ? std::nullopt : std::optional(Clock::now());
+            continue;
+          }
+
+          auto const now = Clock::now();
+          if (closed_ && pending_.empty()) {
+            if (popped == 0)
+              throw make_exception<QueueClosed>("");
+            break;
+          }
+          if (stalled_since_.has_value() && now >= *stalled_since_ + timeout_) {
+            //give up on the missing sequences
+            next_ = pending_.begin()->first;
+            ++skips_;
+            continue;
+          }
+          if (deadline.has_value() && now >= *deadline)
+            break;
+
+          //also wake up when a push starts the stall timer
+          auto const observed_stall = stalled_since_;
+          auto wake = [&]() {
+            return
+              releasable() ||
+              (closed_ && pending_.empty()) ||
+              stalled_since_ != observed_stall;
+          };
+          auto wake_at = deadline;
+          if (stalled_since_.has_value()) {
+            auto const skip_at = *stalled_since_ + timeout_;
+            wake_at = deadline.has_value() ? std::min(*deadline, skip_at) : skip_at;
+          }
+          if (wake_at.has_value())
+            cond_.wait_until(lock, stop, *wake_at, wake);
+          else
+            cond_.wait(lock, stop, wake);
+          if (stop.stop_requested())
+            throw make_exception<StopRequested>("");
+        }
+      }
+      //releases made room in the window
+      if (popped > 0)
+        cond_.notify_all();
+      return popped;
+    }
+
+    //throws QueueClosed once closed and drained
+    T pop(std::stop_token stop) {
+      auto items = std::vector<T>();
+      pop_n(stop, items, 1);
+      return std::move(items.front());
+    }
+
+    auto size() const {
+      auto lock = std::scoped_lock{mut_};
+      return pending_.size();
+    }
+
+    //number of times missing sequences were given up on
+    auto skips() const {
+      auto lock = std::scoped_lock{mut_};
+      return skips_;
+    }
+
+    //number of items that arrived after their sequence had been skipped
+    auto late() const {
+      auto lock = std::scoped_lock{mut_};
+      return late_;
+    }
+
+  private:
+    //mut_ must be held
+    bool releasable() const {
+      return !pending_.empty() && (pending_.begin()->first <= next_ || closed_);
+    }
+
+    //mut_ must be held
+    void throw_if_closed() const {
+      if (closed_)
+        throw make_exception<QueueClosed>("push after close");
+    }
+
+    size_t window_;
+    std::chrono::milliseconds timeout_;
+    std::mutex mutable mut_;
+    std::condition_variable_any cond_;
+    std::map<size_t, T> pending_;
+    //the next sequence to be released
+    size_t next_ = 0;
+    //since when items are waiting without any being released
+    std::optional<Clock::time_point> stalled_since_;
+    size_t skips_ = 0;
+    size_t late_ = 0;
+    bool closed_ = false;
+};
+
+#endif
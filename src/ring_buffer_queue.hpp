@@ -0,0 +1,450 @@
+#ifndef RING_BUFFER_QUEUE_HPP
+#define RING_BUFFER_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <bit>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+#include <stop_token>
+#include <type_traits>
+#include <vector>
+
+#include "common.hpp"
+#include "threadsafe_queue.hpp" //capacity policies and exceptions
+
+//flavours of RingBufferQueue
+// SPSC requires that pushes and pops are each serialized (not necessarily on the same thread)
+struct SingleProducerSingleConsumer {};
+struct MultiProducerMultiConsumer {};
+
+//bounded lock-free alternative to ThreadsafeQueue
+// - push/pop never take a lock unless the queue is full/empty and the caller has to wait
+// - waiting is implemented via a mutex + condition variable that is only touched when
+//   there actually are waiters (tracked by atomic counters)
+// - capacity is rounded up to the next power of two (and is at least 2)
+// - MPMC flavour is Vyukov's bounded queue (per-slot sequence numbers)
+// - close() signals end of stream: consumers drain what's left and then get QueueClosed
+// - optional budget in units of MeasureT (e.g. CountBytes for a memory ceiling) on top of the
+//   slots, kept in an atomic counter that producers reserve from before claiming a slot, an item
+//   larger than the whole budget is still admitted while nothing is reserved (as in
+//   ThreadsafeQueue)
+template <
+  typename T,
+  template<class> typename AtMaxCapacityPolicy = WaitUntilCapacityAvailable,
+  typename Flavour = MultiProducerMultiConsumer,
+  typename MeasureT = CountItems
+>
+class RingBufferQueue : public AtMaxCapacityPolicy<T>
+{
+  static_assert(
+    std::is_same_v<Flavour, SingleProducerSingleConsumer> ||
+    std::is_same_v<Flavour, MultiProducerMultiConsumer>
+  );
+
+  static bool constexpr is_spsc = std::is_same_v<Flavour, SingleProducerSingleConsumer>;
+  static bool constexpr waits_on_capacity =
+    std::is_same_v<AtMaxCapacityPolicy<T>, WaitUntilCapacityAvailable<T>>;
+  static bool constexpr has_budget = !std::is_same_v<MeasureT, CountItems>;
+
+  public:
+    //capacity in slots, budget in units of MeasureT (only enforced if that's not CountItems)
+    RingBufferQueue(size_t capacity, size_t budget = std::numeric_limits<size_t>::max()) :
+        mask_(std::bit_ceil(std::max(capacity, size_t{2})) - 1),
+        slots_(std::make_unique<Slot[]>(mask_ + 1)),
+        budget_(budget) {
+      for (size_t i = 0; i <= mask_; ++i)
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    //can't be safely destroyed while in use (same as ThreadsafeQueue)
+
+    //all pushes must have completed before close is called, pushing afterwards throws
+    //wakes up all waiting consumers (and producers)
+    void close() {
+      closed_.store(true, std::memory_order_seq_cst);
+      { auto lock = std::scoped_lock{mut_}; }
+      not_empty_.notify_all();
+      not_full_.notify_all();
+    }
+
+    bool closed() const {
+      return closed_.load(std::memory_order_acquire);
+    }
+
+    bool try_push(T & item) {
+      throw_if_closed();
+      if (!try_push_budgeted(item, measure_(item)))
+        return false;
+      notify(waiting_consumers_, not_empty_);
+      return true;
+    }
+
+    std::optional<T> try_pop() {
+      auto item = try_pop_impl();
+      if (item.has_value())
+        notify(waiting_producers_, not_full_);
+      return item;
+    }
+
+    void push(T && item) {
+      throw_if_closed();
+      auto const units = measure_(item);
+      while (!try_push_budgeted(item, units))
+        if (!this->on_at_capacity([&]() {wait_until_pushable(std::stop_token(), units);}))
+          return;
+      notify(waiting_consumers_, not_empty_);
+    }
+
+    void push(std::stop_token stop, T && item) requires waits_on_capacity {
+      throw_if_closed();
+      auto const units = measure_(item);
+      while (!try_push_budgeted(item, units)) {
+        wait_until_pushable(stop, units);
+        if (stop.stop_requested())
+          return;
+      }
+      notify(waiting_consumers_, not_empty_);
+    }
+
+    //same semantics as ThreadsafeQueue::push_n, consumers are woken once per filled stretch
+    template <typename IterT>
+    void push_n(std::stop_token stop, IterT first, IterT last) requires waits_on_capacity {
+      throw_if_closed();
+      auto pushed_any = false;
+      while (first != last) {
+        auto const units = measure_(*first);
+        if (try_push_budgeted(*first, units)) {
+          pushed_any = true;
+          ++first;
+          continue;
+        }
+        //wake consumers before blocking so they can make room
+        if (pushed_any)
+          notify(waiting_consumers_, not_empty_);
+        pushed_any = false;
+        wait_until_pushable(stop, units);
+        if (stop.stop_requested())
+          return;
+      }
+      if (pushed_any)
+        notify(waiting_consumers_, not_empty_);
+    }
+
+    //same semantics as ThreadsafeQueue::pop_n, producers are woken once per drained stretch
+    //max_units is checked by peeking at the next item, so pops must be serialized if it's given
+    //once closed and drained it returns what it got so far, or throws QueueClosed if that's nothing
+    size_t pop_n(
+      std::stop_token stop,
+      std::vector<T> & items,
+      size_t count,
+      Deadline deadline = std::nullopt,
+      size_t max_units = std::numeric_limits<size_t>::max()
+    ) {
+      auto const limits_units = max_units != std::numeric_limits<size_t>::max();
+      auto popped = size_t{0};
+      auto popped_units = size_t{0};
+      auto popped_since_notify = false;
+      while (popped < count) {
+        auto item = std::optional<T>();
+        if (!limits_units || popped == 0)
+          item = try_pop_impl();
+        else if (auto const units = peek_units(); units.has_value()) {
+          if (*units > max_units - std::min(popped_units, max_units))
+            break;
+          item = try_pop_impl();
+        }
+        if (item.has_value()) {
+          if (limits_units)
+            popped_units += measure_(*item);
+          items.emplace_back(std::move(*item));
+          ++popped;
+          popped_since_notify = true;
+          continue;
+        }
+        //wake producers before blocking so they can refill
+        if (popped_since_notify)
+          notify(waiting_producers_, not_full_);
+        popped_since_notify = false;
+        wait_until_poppable(stop, deadline);
+        if (stop.stop_requested())
+          throw make_exception<StopRequested>("");
+        if (closed() && !poppable()) {
+          if (popped == 0)
+            throw make_exception<QueueClosed>("");
+          break;
+        }
+        if (deadline.has_value() && std::chrono::steady_clock::now() >= *deadline && !poppable())
+          break;
+      }
+      if (popped_since_notify)
+        notify(waiting_producers_, not_full_);
+      return popped;
+    }
+
+    T pop() {
+      return pop(std::stop_token());
+    }
+
+    //throws QueueClosed once closed and drained
+    T pop(std::stop_token stop) {
+      auto item = try_pop_impl();
+      while (!item.has_value()) {
+        wait_until_poppable(stop);
+        if (stop.stop_requested())
+          throw make_exception<StopRequested>("");
+        item = try_pop_impl();
+        if (!item.has_value() && closed() && !poppable())
+          throw make_exception<QueueClosed>("");
+      }
+      notify(waiting_producers_, not_full_);
+      return std::move(*item);
+    }
+
+    //only a snapshot when used concurrently
+    auto size() const {
+      auto const pop_pos = pop_pos_.value.load(std::memory_order_acquire);
+      auto const push_pos = push_pos_.value.load(std::memory_order_acquire);
+      return push_pos > pop_pos ? push_pos - pop_pos : size_t{0};
+    }
+
+    auto empty() const {
+      return size() == 0;
+    }
+
+    auto capacity() const {
+      return mask_ + 1;
+    }
+
+    //in units of MeasureT including pushes in progress, only a snapshot when used concurrently
+    auto used() const {
+      if constexpr (has_budget)
+        return used_.load(std::memory_order_relaxed);
+      else
+        return size();
+    }
+
+  private:
+    auto static constexpr cache_line_bytes = size_t{64};
+
+    struct Slot {
+      std::atomic<size_t> sequence; //only used by MPMC flavour
+      T item;
+    };
+
+    //keep producer and consumer positions on separate cache lines
+    struct alignas(cache_line_bytes) Position {
+      std::atomic<size_t> value{0};
+      size_t cached{0}; //SPSC only: last seen position of the other side
+    };
+
+    //reserves units of the budget, if nothing is reserved anything goes
+    bool try_reserve(size_t units) {
+      if constexpr (has_budget) {
+        auto used = used_.load(std::memory_order_relaxed);
+        do {
+          if (!fits(used, units))
+            return false;
+        } while (!used_.compare_exchange_weak(used, used + units, std::memory_order_relaxed));
+      }
+      return true;
+    }
+
+    bool fits(size_t used, size_t units) const {
+      return used == 0 || units <= budget_ - std::min(used, budget_);
+    }
+
+    //takes both units of the budget and a slot, or neither
+    bool try_push_budgeted(T & item, size_t units) {
+      if (!try_reserve(units))
+        return false;
+      if (try_push_impl(item))
+        return true;
+      if constexpr (has_budget) {
+        //producers waiting for budget may have seen the reservation
+        used_.fetch_sub(units, std::memory_order_relaxed);
+        notify(waiting_producers_, not_full_);
+      }
+      return false;
+    }
+
+    bool try_push_impl(T & item) {
+      if constexpr (is_spsc) {
+        auto const pos = push_pos_.value.load(std::memory_order_relaxed);
+        if (pos - push_pos_.cached > mask_) {
+          push_pos_.cached = pop_pos_.value.load(std::memory_order_acquire);
+          if (pos - push_pos_.cached > mask_)
+            return false;
+        }
+        slots_[pos & mask_].item = std::move(item);
+        push_pos_.value.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+      else {
+        auto pos = push_pos_.value.load(std::memory_order_relaxed);
+        while (true) {
+          auto & slot = slots_[pos & mask_];
+          auto const sequence = slot.sequence.load(std::memory_order_acquire);
+          auto const diff = static_cast<std::ptrdiff_t>(sequence - pos);
+          if (diff == 0) {
+            if (push_pos_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              slot.item = std::move(item);
+              slot.sequence.store(pos + 1, std::memory_order_release);
+              return true;
+            }
+          }
+          else if (diff < 0)
+            return false; //full
+          else
+            pos = push_pos_.value.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    std::optional<T> try_pop_impl() {
+      if constexpr (is_spsc) {
+        auto const pos = pop_pos_.value.load(std::memory_order_relaxed);
+        if (pos == pop_pos_.cached) {
+          pop_pos_.cached = push_pos_.value.load(std::memory_order_acquire);
+          if (pos == pop_pos_.cached)
+            return std::nullopt;
+        }
+        auto item = std::optional<T>(std::move(slots_[pos & mask_].item));
+        pop_pos_.value.store(pos + 1, std::memory_order_release);
+        release_units(*item);
+        return item;
+      }
+      else {
+        auto pos = pop_pos_.value.load(std::memory_order_relaxed);
+        while (true) {
+          auto & slot = slots_[pos & mask_];
+          auto const sequence = slot.sequence.load(std::memory_order_acquire);
+          auto const diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+          if (diff == 0) {
+            if (pop_pos_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+              auto item = std::optional<T>(std::move(slot.item));
+              slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+              release_units(*item);
+              return item;
+            }
+          }
+          else if (diff < 0)
+            return std::nullopt; //empty
+          else
+            pos = pop_pos_.value.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    //callers of try_pop_impl notify waiting producers
+    void release_units(T const & item) {
+      if constexpr (has_budget)
+        used_.fetch_sub(measure_(item), std::memory_order_relaxed);
+    }
+
+    //units of the next item without popping it, pops must be serialized
+    std::optional<size_t> peek_units() const {
+      auto const pos = pop_pos_.value.load(std::memory_order_relaxed);
+      if constexpr (is_spsc) {
+        if (push_pos_.value.load(std::memory_order_acquire) == pos)
+          return std::nullopt;
+      }
+      else {
+        if (slots_[pos & mask_].sequence.load(std::memory_order_acquire) != pos + 1)
+          return std::nullopt;
+      }
+      return measure_(slots_[pos & mask_].item);
+    }
+
+    bool pushable() const {
+      auto const pos = push_pos_.value.load(std::memory_order_acquire);
+      if constexpr (is_spsc)
+        return pos - pop_pos_.value.load(std::memory_order_acquire) <= mask_;
+      else
+        return slots_[pos & mask_].sequence.load(std::memory_order_acquire) == pos;
+    }
+
+    bool poppable() const {
+      auto const pos = pop_pos_.value.load(std::memory_order_acquire);
+      if constexpr (is_spsc)
+        return push_pos_.value.load(std::memory_order_acquire) != pos;
+      else
+        return slots_[pos & mask_].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    //the seq_cst fences in wait_until and notify pair up so that either the waiter sees the
+    // new state in its predicate or the notifier sees the waiter (no lost wakeups)
+    template <typename PredT>
+    void wait_until(
+      std::stop_token stop,
+      Deadline deadline,
+      std::atomic<size_t> & waiters,
+      std::condition_variable_any & cond,
+      PredT && pred
+    ) {
+      auto lock = std::unique_lock{mut_};
+      waiters.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (deadline.has_value())
+        cond.wait_until(lock, stop, *deadline, pred);
+      else
+        cond.wait(lock, stop, pred);
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wait_until_pushable(std::stop_token stop, size_t units) {
+      wait_until(
+        stop,
+        std::nullopt,
+        waiting_producers_,
+        not_full_,
+        [&]() {return pushable() && fits(used_.load(std::memory_order_relaxed), units);}
+      );
+    }
+
+    void wait_until_poppable(std::stop_token stop, Deadline deadline = std::nullopt) {
+      wait_until(
+        stop,
+        deadline,
+        waiting_consumers_,
+        not_empty_,
+        [&]() {return poppable() || closed();}
+      );
+    }
+
+    void throw_if_closed() const {
+      if (closed())
+        throw make_exception<QueueClosed>("push after close");
+    }
+
+    void notify(std::atomic<size_t> & waiters, std::condition_variable_any & cond) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiters.load(std::memory_order_relaxed) == 0)
+        return;
+      //taking the mutex ensures that a waiter is either still before its predicate check or
+      // already blocked in wait
+      { auto lock = std::scoped_lock{mut_}; }
+      cond.notify_all();
+    }
+
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t budget_;
+    //reserved units of the budget, unused without one
+    alignas(cache_line_bytes) std::atomic<size_t> used_{0};
+    [[no_unique_address]] MeasureT measure_;
+    Position push_pos_;
+    Position pop_pos_;
+
+    std::mutex mut_;
+    std::condition_variable_any not_empty_;
+    std::condition_variable_any not_full_;
+    std::atomic<size_t> waiting_consumers_{0};
+    std::atomic<size_t> waiting_producers_{0};
+    std::atomic<bool> closed_{false};
+};
+
+#endif
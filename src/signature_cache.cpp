@@ -0,0 +1,108 @@
+#include "signature_cache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+  thread_local auto key_buffer = std::string();
+}
+
+SignatureCache::SignatureCache(Options const & options) :
+    max_message_bytes_(options.max_message_bytes),
+    max_shard_bytes_(options.max_bytes / std::max(options.shards, size_t{1})),
+    shard_count_(std::max(options.shards, size_t{1})),
+    shards_(std::make_unique<Shard[]>(shard_count_)) {
+}
+
+bool SignatureCache::lookup(
+  std::string_view message,
+  bool prehashed,
+  SignerIndex & signer,
+  Signature & signature
+) {
+  if (!cacheable(message))
+    return false;
+
+  auto const key = hashed_key(message, prehashed);
+  auto & shard = this->shard(key.hash);
+  {
+    auto lock = std::scoped_lock(shard.mut);
+    auto const it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      signer = it->second->signer;
+      signature = it->second->signature;
+      hits_.add();
+      return true;
+    }
+  }
+  misses_.add();
+  return false;
+}
+
+void SignatureCache::insert(
+  std::string_view message,
+  bool prehashed,
+  SignerIndex signer,
+  Signature const & signature
+) {
+  if (message.size() > max_message_bytes_)
+    return;
+
+  auto const key = hashed_key(message, prehashed);
+  auto & shard = this->shard(key.hash);
+  auto lock = std::scoped_lock(shard.mut);
+  //another thread signed the same message concurrently, either signature is fine
+  if (shard.index.contains(key))
+    return;
+
+  auto & entry = shard.lru.emplace_front(Entry{std::string(key.key), key.hash, signer, signature});
+  shard.index.emplace(HashedKey{entry.hash, entry.key}, shard.lru.begin());
+  auto const added = entry_bytes(entry);
+  shard.bytes += added;
+  bytes_.fetch_add(added, std::memory_order_relaxed);
+
+  while (shard.bytes > max_shard_bytes_ && !shard.lru.empty()) {
+    auto const & evicted = shard.lru.back();
+    auto const removed = entry_bytes(evicted);
+    shard.index.erase(HashedKey{evicted.hash, evicted.key});
+    shard.lru.pop_back();
+    shard.bytes -= removed;
+    bytes_.fetch_sub(removed, std::memory_order_relaxed);
+    evictions_.add();
+  }
+}
+
+void SignatureCache::register_metrics(MetricsRegistry & registry) {
+  registry.add("signature_cache_hits", hits_);
+  registry.add("signature_cache_misses", misses_);
+  registry.add("signature_cache_skipped", skipped_);
+  registry.add("signature_cache_evictions", evictions_);
+  registry.add(
+    "signature_cache_bytes",
+    [this]() {return static_cast<std::int64_t>(bytes_.load(std::memory_order_relaxed));}
+  );
+}
+
+bool SignatureCache::cacheable(std::string_view message) {
+  if (message.size() <= max_message_bytes_)
+    return true;
+  skipped_.add();
+  return false;
+}
+
+SignatureCache::HashedKey SignatureCache::hashed_key(
+  std::string_view message,
+  bool prehashed
+) const {
+  key_buffer.clear();
+  key_buffer.push_back(prehashed ? '\1' : '\0');
+  key_buffer.append(message);
+  return HashedKey{std::hash<std::string_view>()(key_buffer), key_buffer};
+}
+
+//the list node and hash table node overheads are estimates
+size_t SignatureCache::entry_bytes(Entry const & entry) {
+  auto constexpr node_overhead = 4 * sizeof(void *);
+  return sizeof(Entry) + entry.key.capacity() + sizeof(HashedKey) + node_overhead;
+}
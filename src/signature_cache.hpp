@@ -0,0 +1,99 @@
+#ifndef SIGNATURE_CACHE_HPP
+#define SIGNATURE_CACHE_HPP
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "common.hpp"
+#include "crypto_sizes.hpp"
+#include "metrics.hpp"
+#include "record_types.hpp"
+
+//ed25519 is deterministic, so a message that was signed before can reuse its signature along
+// with the signer that made it (i.e. the cached signer stays pinned to the message)
+//bounded, sharded LRU keyed by a hash of the message, hits are confirmed by comparing the stored
+// copy of the message so a hash collision can never hand out a wrong signature
+//messages larger than max_message_bytes are skipped: hashing and comparing them costs about as
+// much as signing, and they'd crowd out everything else
+class SignatureCache {
+  public:
+    struct Options {
+      //message copies plus bookkeeping, split evenly across the shards
+      size_t max_bytes = size_t{64} << 20;
+      size_t max_message_bytes = 1024;
+      size_t shards = 16;
+    };
+
+    SignatureCache() : SignatureCache(Options()) {}
+    SignatureCache(Options const & options);
+
+    //message is the digest for prehashed records (see Record::prehashed)
+    //on a hit signer and signature are set
+    bool lookup(
+      std::string_view message,
+      bool prehashed,
+      SignerIndex & signer,
+      Signature & signature
+    );
+    void insert(
+      std::string_view message,
+      bool prehashed,
+      SignerIndex signer,
+      Signature const & signature
+    );
+
+    void register_metrics(MetricsRegistry & registry);
+
+  private:
+    struct Entry {
+      //prehashed flag || message
+      std::string key;
+      size_t hash;
+      SignerIndex signer;
+      Signature signature;
+    };
+
+    //the hash is computed once per call and stored along with the key it was computed from
+    struct HashedKey {
+      size_t hash;
+      std::string_view key;
+
+      bool operator==(HashedKey const & other) const {return key == other.key;}
+    };
+
+    struct KeyHash {
+      size_t operator()(HashedKey const & key) const {return key.hash;}
+    };
+
+    struct alignas(64) Shard {
+      std::mutex mut;
+      //most recently used first
+      std::list<Entry> lru;
+      //keys point into the entries' key strings
+      std::unordered_map<HashedKey, std::list<Entry>::iterator, KeyHash> index;
+      size_t bytes = 0;
+    };
+
+    bool cacheable(std::string_view message);
+    //builds the key in a thread local buffer
+    HashedKey hashed_key(std::string_view message, bool prehashed) const;
+    Shard & shard(size_t hash) {return shards_[(hash >> 32 ^ hash) % shard_count_];}
+    static size_t entry_bytes(Entry const & entry);
+
+    size_t max_message_bytes_;
+    size_t max_shard_bytes_;
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<size_t> bytes_ = 0;
+    Counter hits_;
+    Counter misses_;
+    Counter skipped_; //too large to be cached
+    Counter evictions_;
+};
+
+#endif
@@ -1,64 +1,351 @@
 #include "sink_service.hpp"
 
-#include <random>
-#include <numeric>
+#include <algorithm>
+#include <vector>
 
 #include <SQLiteCpp/SQLiteCpp.h>
 
+#include "checkpoint_tracker.hpp"
 #include "crypto_sizes.hpp"
+#include "hex.hpp"
+#include "key_service.hpp"
+#include "merkle.hpp"
 
-auto constexpr hex_digits_per_byte = size_t{2};
+auto constexpr busy_timeout_ms = 5000;
 
 SinkService::SinkService(
   std::string const & dbfile,
   size_t queue_capacity
+) : SinkService(dbfile, queue_capacity, Options()) {
+}
+
+SinkService::SinkService(
+  std::string const & dbfile,
+  size_t queue_capacity,
+  Options const & options
 ) : dbfile_(dbfile), 
-    batch_queue_(queue_capacity) {
+    options_(options),
+    batch_queue_(queue_capacity, options.reorder_timeout),
+    pools_(std::make_shared<BufferPools>()) {
   auto db = SQLite::Database(dbfile_, SQLite::OPEN_READWRITE|SQLite::OPEN_CREATE);
-  db.exec("DROP TABLE IF EXISTS signed");
+  db.setBusyTimeout(busy_timeout_ms);
+  //persistent, so it's set here before any reader of the db starts rather than in work_loop
+  if (options_.journal_mode.has_value())
+    db.exec("PRAGMA journal_mode=" + *options_.journal_mode);
+  auto column_exists = [&](std::string const & table, std::string const & column) {
+    auto query = SQLite::Statement(
+      db,
+      "SELECT COUNT(*) FROM pragma_table_info(?) WHERE name = ?"
+    );
+    query.bind(1, table);
+    query.bind(2, column);
+    query.executeStep();
+    return query.getColumn(0).getInt() != 0;
+  };
+  //checkpoints without shard column predate sharded sources and can't be resumed from
+  auto const sharded_checkpoint = column_exists("checkpoint", "shard");
+  if (!options_.resume || !sharded_checkpoint)
+    db.exec("DROP TABLE IF EXISTS checkpoint");
+  if (!options_.resume) {
+    if (options_.mode == Mode::insert) {
+      db.exec("DROP TABLE IF EXISTS signed");
+      db.exec("DROP TABLE IF EXISTS signers");
+    }
+  }
   db.exec(
-  "CREATE TABLE signed ("
-    "id INTEGER PRIMARY KEY, "
-    "signature CHAR(" + std::to_string(hex_digits_per_byte * signature_bytes) + "), "
-    "signer CHAR(" + std::to_string(hex_digits_per_byte * public_key_bytes) + ")"
-  ")"
-);
+    "CREATE TABLE IF NOT EXISTS checkpoint ("
+      "shard INTEGER PRIMARY KEY, last_id INTEGER, end_id INTEGER"
+    ")"
+  );
+  if (options_.mode == Mode::insert) {
+    switch (options_.format) {
+      case Format::hex:
+        db.exec(
+          "CREATE TABLE IF NOT EXISTS signed ("
+            "id INTEGER PRIMARY KEY, "
+            "signature CHAR(" + std::to_string(hex_digits_per_byte * signature_bytes) + "), "
+            "signer CHAR(" + std::to_string(hex_digits_per_byte * public_key_bytes) + "), "
+            "proof TEXT, "
+            "prehashed INTEGER"
+          ")"
+        );
+        break;
+      case Format::binary:
+        db.exec(
+          "CREATE TABLE IF NOT EXISTS signed ("
+            "id INTEGER PRIMARY KEY, "
+            "signature BLOB, "
+            "signer INTEGER REFERENCES signers(id), "
+            "proof BLOB, "
+            "prehashed INTEGER"
+          ")"
+        );
+        break;
+    }
+  }
+  //merkle inclusion proofs (NULL for records that were signed individually) and whether the
+  // digest of the message was signed, tables of resumed runs may predate them
+  auto const signed_table = std::string(options_.mode == Mode::insert ? "signed" : "messages");
+  for (auto const & column : {"proof", "prehashed"})
+    if (!column_exists(signed_table, column))
+      db.exec("ALTER TABLE " + signed_table + " ADD COLUMN " + column);
+  //in update_messages mode the signers accumulate across runs so previously written rows
+  // keep resolving
+  if (options_.format == Format::binary)
+    db.exec(
+      "CREATE TABLE IF NOT EXISTS signers (id INTEGER PRIMARY KEY, public_key BLOB UNIQUE)"
+    );
 }
 
 void SinkService::put(std::stop_token stop, SignedBatch && signed_batch) {
-  batch_queue_.push(stop, std::move(signed_batch));
+  auto const sequence = signed_batch.sequence;
+  batch_queue_.push(stop, sequence, std::move(signed_batch));
 }
 
-void SinkService::start(size_t log_frequency) {
+void SinkService::close() {
+  batch_queue_.close();
+}
+
+ShardRanges SinkService::checkpoint() const {
+  auto db = SQLite::Database(dbfile_, SQLite::OPEN_READONLY);
+  auto query = SQLite::Statement(db, "SELECT last_id, end_id FROM checkpoint ORDER BY shard");
+  auto shards = ShardRanges();
+  while (query.executeStep())
+    shards.push_back(IdRange{query.getColumn(0).getInt64(), query.getColumn(1).getInt64()});
+  return shards;
+}
+
+void SinkService::start(
+  KeyService const & key_service,
+  ShardRanges const & shards,
+  size_t log_frequency
+) {
   using namespace std::placeholders;
-  start_thread(std::bind(&SinkService::work_loop, this, _1, _2), log_frequency);
+  start_thread(
+    std::bind(&SinkService::work_loop, this, _1, _2, _3, _4),
+    std::cref(key_service),
+    shards,
+    log_frequency
+  );
+}
+
+void SinkService::register_metrics(MetricsRegistry & registry) {
+  registry.add("sink_records_in", metrics_.records_in);
+  registry.add("sink_batches_in", metrics_.batches_in);
+  registry.add("sink_commits", metrics_.commits);
+  registry.add("sink_commit_latency_ns", metrics_.commit_latency);
+  registry.add(
+    "sink_batch_queue_depth",
+    [this]() {return static_cast<std::int64_t>(batch_queue_.size());}
+  );
+  registry.add(
+    "sink_reorder_skips",
+    [this]() {return static_cast<std::int64_t>(batch_queue_.skips());}
+  );
+  registry.add(
+    "sink_reorder_late",
+    [this]() {return static_cast<std::int64_t>(batch_queue_.late());}
+  );
+}
+
+std::vector<int64_t> SinkService::register_signers(
+  SQLite::Database & db,
+  KeyService const & key_service
+) {
+  auto insert_query = SQLite::Statement(
+    db,
+    "INSERT OR IGNORE INTO signers (public_key) VALUES (?)"
+  );
+  auto select_query = SQLite::Statement(db, "SELECT id FROM signers WHERE public_key = ?");
+  auto public_key = std::array<std::byte, public_key_bytes>();
+  auto signer_ids = std::vector<int64_t>();
+  signer_ids.reserve(key_service.key_count());
+  auto transaction = SQLite::Transaction(db);
+  for (size_t i = 0; i < key_service.key_count(); ++i) {
+    auto const index = static_cast<SignerIndex>(i);
+    from_hex(key_service.public_key(index), public_key);
+    insert_query.bindNoCopy(1, public_key.data(), static_cast<int>(public_key.size()));
+    insert_query.exec();
+    insert_query.reset();
+    select_query.bindNoCopy(1, public_key.data(), static_cast<int>(public_key.size()));
+    if (!select_query.executeStep())
+      throw make_exception<Exception>("failed to register signer: " + std::to_string(index));
+    signer_ids.push_back(select_query.getColumn(0).getInt64());
+    select_query.reset();
+  }
+  transaction.commit();
+  return signer_ids;
 }
 
-void SinkService::work_loop(std::stop_token stop, size_t log_frequency) {
+void SinkService::work_loop(
+  std::stop_token stop,
+  KeyService const & key_service,
+  ShardRanges const & shards,
+  size_t log_frequency
+) {
   log("SinkService: work_loop started");
   auto db = SQLite::Database(dbfile_, SQLite::OPEN_READWRITE);
-  auto insert_query = SQLite::Statement(db, "INSERT INTO signed VALUES (?, ?, ?)");
+  db.setBusyTimeout(busy_timeout_ms);
+  if (options_.synchronous.has_value())
+    db.exec("PRAGMA synchronous=" + *options_.synchronous);
+  if (options_.cache_size.has_value())
+    db.exec("PRAGMA cache_size=" + std::to_string(*options_.cache_size));
+
+  auto const signer_ids =
+    options_.format == Format::binary
+    ? register_signers(db, key_service)
+    : std::vector<int64_t>();
+
+  auto write_query = SQLite::Statement(
+    db,
+    options_.mode == Mode::insert
+    //rows past the checkpoint may already have been written before a restart
+    ? "INSERT OR REPLACE INTO signed (id, signature, signer, proof, prehashed) "
+      "VALUES (?1, ?2, ?3, ?4, ?5)"
+    : "UPDATE messages SET signature = ?2, signer = ?3, proof = ?4, prehashed = ?5 WHERE id = ?1"
+  );
+  auto signature_hex = std::string(hex_digits_per_byte * signature_bytes, '\0');
+  auto merkle_path_buffer = std::vector<MerkleHash>();
+  auto proof = std::vector<std::byte>();
+  auto proof_hex = std::string();
+  //merkle_tree is the tree of the record's batch
+  auto write = [&](
+    SignedRecord const & signed_record,
+    std::vector<MerkleHash> const & merkle_tree
+  ) {
+    write_query.bind(1, signed_record.id);
+    if (options_.format == Format::hex) {
+      to_hex(signed_record.signature, signature_hex.data());
+      write_query.bindNoCopy(2, signature_hex);
+      write_query.bindNoCopy(3, key_service.public_key(signed_record.signer));
+    }
+    else {
+      write_query.bindNoCopy(
+        2,
+        signed_record.signature.data(),
+        static_cast<int>(signed_record.signature.size())
+      );
+      write_query.bind(3, signer_ids[signed_record.signer]);
+    }
+    if (signed_record.leaf_count == 0)
+      write_query.bind(4);
+    else {
+      merkle_path(
+        merkle_tree,
+        signed_record.leaf_count,
+        signed_record.leaf_index,
+        merkle_path_buffer
+      );
+      encode_merkle_proof(
+        signed_record.leaf_index,
+        signed_record.leaf_count,
+        merkle_path_buffer,
+        proof
+      );
+      if (options_.format == Format::hex) {
+        proof_hex.resize(hex_digits_per_byte * proof.size());
+        to_hex(proof, proof_hex.data());
+        write_query.bindNoCopy(4, proof_hex);
+      }
+      else
+        write_query.bindNoCopy(4, proof.data(), static_cast<int>(proof.size()));
+    }
+    write_query.bind(5, signed_record.prehashed ? 1 : 0);
+    if (write_query.exec() != 1)
+      throw make_exception<Exception>(
+        "write failed for id: " +
+        std::to_string(signed_record.id)
+      );
+    write_query.reset();
+  };
+
+  //rows of resumed shards already exist and keep their last_id
+  {
+    auto insert_query = SQLite::Statement(
+      db,
+      "INSERT OR IGNORE INTO checkpoint (shard, last_id, end_id) VALUES (?, ?, ?)"
+    );
+    auto transaction = SQLite::Transaction(db);
+    for (size_t shard = 0; shard < shards.size(); ++shard) {
+      insert_query.bind(1, static_cast<int64_t>(shard));
+      insert_query.bind(2, shards[shard].after_id);
+      insert_query.bind(3, shards[shard].end_id);
+      insert_query.exec();
+      insert_query.reset();
+    }
+    transaction.commit();
+  }
+
+  auto checkpoint_query = SQLite::Statement(
+    db,
+    "UPDATE checkpoint SET last_id = ?2 WHERE shard = ?1"
+  );
+  auto checkpoint_trackers = std::vector<CheckpointTracker>(shards.size());
+
   try {
-    for (size_t i = 1; true; ++i) {
-        auto batch = batch_queue_.pop(stop);
+    auto batches = std::vector<SignedBatch>();
+    //records paired with the merkle tree of their batch
+    auto sorted_records =
+      std::vector<std::pair<SignedRecord const *, std::vector<MerkleHash> const *>>();
+    auto batches_written = size_t{0};
+    auto closed = false;
+    for (size_t i = 1; !closed; ++i) {
+      //group commit: block for the first batch, then coalesce whatever else arrives until
+      // either max_commit_rows or max_commit_latency is reached
+      batches.clear();
+      batches.push_back(batch_queue_.pop(stop));
+      auto rows = batches.back().records.size();
+      auto const deadline = std::chrono::steady_clock::now() + options_.max_commit_latency;
+      try {
+        while (rows < options_.max_commit_rows && batch_queue_.pop_n(stop, batches, 1, deadline) > 0)
+          rows += batches.back().records.size();
+      }
+      catch (QueueClosed const &) {
+        closed = true; //commit what we have, then exit
+      }
+
+      //batches arrive in order, sorting within the commit orders the interleaved shards too, so
+      // writing keeps b-tree access sequential
+      sorted_records.clear();
+      for (auto const & batch : batches) {
+        for (auto const & signed_record : batch.records)
+          sorted_records.emplace_back(&signed_record, &batch.merkle_tree);
+        for (auto const & progress : batch.progress)
+          checkpoint_trackers.at(progress.shard).add(progress);
+      }
+      std::sort(
+        sorted_records.begin(),
+        sorted_records.end(),
+        [](auto const & lhs, auto const & rhs) {return lhs.first->id < rhs.first->id;}
+      );
+
+      {
+        auto timer = ScopedTimer(metrics_.commit_latency);
         auto transaction = SQLite::Transaction(db);
-        for (auto const & signed_record : batch) {
-          insert_query.bind(1, signed_record.id);
-          insert_query.bindNoCopy(2, signed_record.signature);
-          insert_query.bindNoCopy(3, signed_record.signer);
-          if (insert_query.exec() != 1)
-            throw make_exception<Exception>(
-              "insert failed for id: " +
-              std::to_string(signed_record.id)
-            );
-          insert_query.reset();
+        for (auto [signed_record, merkle_tree] : sorted_records)
+          write(*signed_record, *merkle_tree);
+        for (size_t shard = 0; shard < checkpoint_trackers.size(); ++shard) {
+          if (auto checkpoint = checkpoint_trackers[shard].advance(); checkpoint.has_value()) {
+            checkpoint_query.bind(1, static_cast<int64_t>(shard));
+            checkpoint_query.bind(2, *checkpoint);
+            checkpoint_query.exec();
+            checkpoint_query.reset();
+          }
         }
         transaction.commit();
+      }
+      metrics_.records_in.add(sorted_records.size());
+      metrics_.batches_in.add(batches.size());
+      metrics_.commits.add();
+      for (auto & batch : batches)
+        pools_->release_signed_batch(std::move(batch));
+      batches_written += batches.size();
       
       if (i % log_frequency == 0)
-        log("SinkService: wrote " + std::to_string(i) + " batches");
+        log("SinkService: wrote {} batches in {} commits", batches_written, i);
     }
   }
   catch (StopRequested const &) {}
+  catch (QueueClosed const &) {}
   log("SinkService: work_loop ended");
-}
\ No newline at end of file
+}
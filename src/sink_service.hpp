@@ -1,24 +1,104 @@
 #ifndef SINK_SERVICE_HPP
 #define SINK_SERVICE_HPP
 
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "buffer_pool.hpp"
 #include "common.hpp"
+#include "metrics.hpp"
 #include "microservice.hpp"
-#include "threadsafe_queue.hpp"
 #include "record_types.hpp"
+#include "reorder_buffer.hpp"
+
+class KeyService;
+
+namespace SQLite {
+  class Database;
+}
 
 class SinkService : public Microservice {
   public:
+    enum class Mode {
+      insert,         //separate signed table, recreated on construction
+      update_messages //write signature/signer back into the messages table of a shared (WAL) db
+    };
+
+    enum class Format {
+      hex,   //signature and public key as hex CHAR columns in every row
+      binary //raw signature BLOB and an integer signer referencing the signers table
+    };
+
+    struct Options {
+      Mode mode = Mode::insert;
+      Format format = Format::hex;
+      //keep previously written rows and the checkpoint instead of starting from scratch
+      bool resume = false;
+
+      //group commit: one transaction spans queued batches until either limit is hit
+      size_t max_commit_rows = 10000;
+      std::chrono::milliseconds max_commit_latency = std::chrono::milliseconds(50);
+
+      //batches are written in the order they were cut (ascending ids per source shard), a batch
+      // that keeps the ones behind it waiting for longer than this is given up on
+      std::chrono::milliseconds reorder_timeout = std::chrono::milliseconds(1000);
+
+      //pragmas (nullopt = sqlite default), journal_mode is persistent and set on construction,
+      // the others apply to the writing connection
+      std::optional<std::string> journal_mode = "WAL";
+      std::optional<std::string> synchronous = "NORMAL";
+      std::optional<int> cache_size = -65536; //negative values are KiB
+    };
+
+    //queue_capacity is the reorder window: a batch more than that many sequences ahead of the next
+    // one to be written blocks in put
     SinkService(std::string const & dbfile, size_t queue_capacity);
+    SinkService(std::string const & dbfile, size_t queue_capacity, Options const & options);
 
+    //batches are put in any order, see SignedBatch::sequence
     void put(std::stop_token stop, SignedBatch && signed_batch);
+    //end of stream: everything put so far gets committed, then the work loop exits
+    void close();
+
+    //per source shard, the id up to which all its messages have been committed (as after_id,
+    // advanced atomically with the writes) and the end of its range, empty if there are none
+    ShardRanges checkpoint() const;
+
+    //key_service resolves the signer indices of signed records
+    //shards are the ranges the source was started with (see SourceService::plan_shards)
+    void start(KeyService const & key_service, ShardRanges const & shards, size_t log_frequency);
 
-    void start(size_t log_frequency);
+    void register_metrics(MetricsRegistry & registry) override;
+
+    //recycles signed record, progress and merkle tree vectors
+    void share_buffer_pools(std::shared_ptr<BufferPools> pools) {pools_ = std::move(pools);}
   
   private:
-    void work_loop(std::stop_token stop, size_t log_frequency);
+    struct Metrics {
+      Counter records_in;
+      Counter batches_in;
+      Counter commits;
+      Histogram commit_latency; //from beginning the transaction until it's committed
+    };
+
+    void work_loop(
+      std::stop_token stop,
+      KeyService const & key_service,
+      ShardRanges const & shards,
+      size_t log_frequency
+    );
+
+    //returns the signers table ids of all keys indexed by SignerIndex
+    std::vector<int64_t> register_signers(SQLite::Database & db, KeyService const & key_service);
 
     std::string dbfile_;
-    ThreadsafeQueue<SignedBatch, WaitUntilCapacityAvailable> batch_queue_;
+    Options options_;
+    //pushed to by all signing threads, restores the order in which the batches were cut
+    ReorderBuffer<SignedBatch> batch_queue_;
+    Metrics metrics_;
+    std::shared_ptr<BufferPools> pools_;
 };
 
 #endif
@@ -1,14 +1,74 @@
 #include "source_service.hpp"
 
+#include <algorithm>
+#include <exception>
 #include <random>
 #include <numeric>
+#include <memory>
+#include <thread>
+#include <variant>
 
+#include <sqlite3.h>
+#include <cryptopp/sha.h>
 #include <SQLiteCpp/SQLiteCpp.h>
 
-auto constexpr hex_digits_per_byte = size_t{2};
+#include "crypto_sizes.hpp"
+#include "message_generator.hpp"
+#include "ring_buffer_queue.hpp"
 
-SourceService::SourceService(std::string const & dbfile) : 
-  dbfile_(dbfile) {
+auto constexpr prehash_chunk_bytes = 1 << 16;
+
+namespace {
+  //streams the message with the given id into a SHA-512 digest using incremental BLOB I/O
+  void prehash_message(
+    SQLite::Database & db,
+    int id,
+    std::vector<char> & buffer,
+    std::string & digest
+  ) {
+    auto handle = db.getHandle();
+    sqlite3_blob * raw_blob = nullptr;
+    if (sqlite3_blob_open(handle, "main", "messages", "message", id, 0, &raw_blob) != SQLITE_OK) {
+      sqlite3_blob_close(raw_blob);
+      throw make_exception<Exception>(
+        "failed to open message blob for id: " + std::to_string(id) +
+        " error: " + sqlite3_errmsg(handle)
+      );
+    }
+    auto blob = std::unique_ptr<sqlite3_blob, decltype(&sqlite3_blob_close)>(
+      raw_blob,
+      &sqlite3_blob_close
+    );
+
+    buffer.resize(prehash_chunk_bytes);
+    auto hash = CryptoPP::SHA512();
+    auto const size = sqlite3_blob_bytes(blob.get());
+    for (auto offset = 0; offset < size; offset += prehash_chunk_bytes) {
+      auto const bytes = std::min(prehash_chunk_bytes, size - offset);
+      if (sqlite3_blob_read(blob.get(), buffer.data(), bytes, offset) != SQLITE_OK)
+        throw make_exception<Exception>(
+          "failed to read message blob for id: " + std::to_string(id) +
+          " at offset: " + std::to_string(offset)
+        );
+      hash.Update(reinterpret_cast<CryptoPP::byte const *>(buffer.data()), bytes);
+    }
+
+    digest.resize(prehash_digest_bytes);
+    hash.Final(reinterpret_cast<CryptoPP::byte *>(digest.data()));
+  }
+}
+
+SourceService::SourceService(std::string const & dbfile) :
+  SourceService(dbfile, Options()) {
+}
+
+SourceService::SourceService(
+  std::string const & dbfile,
+  Options const & options
+) : dbfile_(dbfile),
+    options_(options),
+    next_shard_(0),
+    pools_(std::make_shared<BufferPools>()) {
     auto db = SQLite::Database(dbfile_, SQLite::OPEN_READWRITE|SQLite::OPEN_CREATE);
     auto table_exists = [&]() {
       return SQLite::Statement(
@@ -16,9 +76,23 @@ SourceService::SourceService(std::string const & dbfile) :
         "SELECT name FROM sqlite_master WHERE type='table' AND name='messages'"
       ).executeStep();
     };
+    auto column_exists = [&](std::string const & column) {
+      auto query = SQLite::Statement(
+        db,
+        "SELECT COUNT(*) FROM pragma_table_info('messages') WHERE name=?"
+      );
+      query.bind(1, column);
+      query.executeStep();
+      return query.getColumn(0).getInt() != 0;
+    };
 
     if (!table_exists())
       db.exec("CREATE TABLE messages (id INTEGER PRIMARY KEY, size INTERGER, message TEXT)");
+
+    //untyped since their content depends on SinkService::Format
+    for (auto const & column : {"signature", "signer", "proof", "prehashed"})
+      if (!column_exists(column))
+        db.exec("ALTER TABLE messages ADD COLUMN " + std::string(column));
 }
 
 bool SourceService::is_empty() const {
@@ -30,100 +104,216 @@ bool SourceService::is_empty() const {
 }
 
 void SourceService::populate(size_t count) {
-  auto rng = std::mt19937_64(std::random_device()());
-  auto pareto_distribution = [&rng](auto shape) {
-    return [&rng, shape]() {
-      //see https://en.wikipedia.org/wiki/Pareto_distribution#Relation_to_the_exponential_distribution
-      auto static exp_distr = std::exponential_distribution<>(shape);
-      auto res = std::exp(exp_distr(rng));
-      using ResultType = decltype(res);
-      return 
-        res != std::numeric_limits<ResultType>::infinity()
-        ? res
-        : std::numeric_limits<ResultType>::max();
-    };
-  };
+  populate(count, PopulateOptions());
+}
 
-  //reality is fat-tailed and doesn't even owe you an expected value
-  // (but we at least limit it max_message_bytes)
-  auto constexpr pareto_shape = 1.0;
-  auto pareto_rng = pareto_distribution(pareto_shape);
-
-  //create a random hex string whose length is pareto distributed
-  auto create_random_message = [&rng, &pareto_rng]() {
-    //ensure that max_random_message_bytes can fit in EntropyType
-    using EntropyType = decltype(rng());
-    using ParetoType = decltype(pareto_rng());
-    static_assert(
-      static_cast<double>(max_random_message_bytes)
-      <=
-      static_cast<double>(std::numeric_limits<EntropyType>::max())
-    );
+//generator threads are statically assigned the chunks i with i % threads == thread, and each
+// hands them over via its own SPSC queue, which the writer drains round-robin, i.e. in chunk
+// order, so the resulting ids don't depend on thread scheduling
+void SourceService::populate(size_t count, PopulateOptions const & options) {
+  using Chunk = std::vector<std::string>;
+  //a generator that fails hands over its exception in place of the chunk
+  using ChunkOrError = std::variant<Chunk, std::exception_ptr>;
+  using ChunkQueue =
+    RingBufferQueue<ChunkOrError, WaitUntilCapacityAvailable, SingleProducerSingleConsumer>;
+  auto constexpr chunk_queue_capacity = 4;
 
-    //sample pareto distribution for number of bytes of message
-    auto pareto_sample = pareto_rng();
-    
-    //cap actual size using max_random_message_bytes
-    using LargerType = decltype(ParetoType{} + max_random_message_bytes);
-    auto const message_bytes = static_cast<EntropyType>(
-      //find minimum in LargerType then safely convert result to EntropyType
-      //  (a static_cast from double to integer that overflows is undefined behavior)
-      std::min<LargerType>(pareto_sample, max_random_message_bytes)
-    );
-    
-    //allocate message
-    auto message = std::string(hex_digits_per_byte * message_bytes, '\0'); //might throw
-    
-    //fill message with hex characters using rng (efficiently) for entropy
-    auto entropy = EntropyType();
-    for (size_t i = 0; i < message_bytes; ++i) {
-      auto constexpr bytes_per_entropy = sizeof(EntropyType);
-      if (i % bytes_per_entropy == 0)
-        entropy = rng();
-      for (size_t j = 0; j < hex_digits_per_byte; ++j) { //can be unrolled
-        auto hex_digit = entropy % 16;
-        entropy >>= 4;
-        message[2*i + j] = static_cast<char>(hex_digit < 10 ? '0' + hex_digit : 'A' + hex_digit-10);
+  auto const base_seed = options.seed.value_or(std::random_device()());
+  auto const chunk_rows = std::max(options.chunk_rows, size_t{1});
+  auto const chunk_count = (count + chunk_rows - 1) / chunk_rows;
+  auto const threads = std::clamp<size_t>(
+    options.threads != 0 ? options.threads : std::thread::hardware_concurrency(),
+    1,
+    std::max(chunk_count, size_t{1})
+  );
+
+  auto queues = std::vector<std::unique_ptr<ChunkQueue>>();
+  for (size_t t = 0; t < threads; ++t)
+    queues.push_back(std::make_unique<ChunkQueue>(chunk_queue_capacity));
+
+  auto generate = [&](std::stop_token stop, size_t thread) {
+    try {
+      for (auto chunk_index = thread; chunk_index < chunk_count; chunk_index += threads) {
+        auto seed = std::seed_seq{
+          static_cast<std::uint32_t>(base_seed), static_cast<std::uint32_t>(base_seed >> 32),
+          static_cast<std::uint32_t>(chunk_index), static_cast<std::uint32_t>(chunk_index >> 32)
+        };
+        auto generator = MessageGenerator(std::mt19937_64(seed)());
+        auto const rows = std::min(chunk_rows, count - chunk_index * chunk_rows);
+        auto chunk = Chunk();
+        chunk.reserve(rows);
+        for (size_t i = 0; i < rows && !stop.stop_requested(); ++i)
+          chunk.push_back(generator.next());
+        queues[thread]->push(stop, ChunkOrError(std::move(chunk)));
+        if (stop.stop_requested())
+          return;
       }
     }
-
-    return message;
+    catch (...) {
+      queues[thread]->push(stop, ChunkOrError(std::current_exception()));
+    }
   };
 
+  //declared after everything they reference, so they are stopped and joined first
+  auto generators = std::vector<std::jthread>();
+  for (size_t t = 0; t < threads; ++t)
+    generators.emplace_back(generate, t);
+
   auto db = SQLite::Database(dbfile_, SQLite::OPEN_READWRITE);
-  auto insert_query = SQLite::Statement(db, "INSERT INTO messages VALUES (NULL, ?, ?)");
-  for (size_t i = 0; i < count; ++i) {
-    auto message = create_random_message();
-    insert_query.bind(1, static_cast<int64_t>(message.size()));
-    insert_query.bindNoCopy(2, message);
-    if (insert_query.exec() != 1)
-      throw make_exception<Exception>(
-        "Insertion failed at count: " + std::to_string(i) +
-        " for message with size: " + std::to_string(message.size())
-      );
-    insert_query.reset();
+  auto insert_query = SQLite::Statement(db, "INSERT INTO messages (size, message) VALUES (?, ?)");
+  auto transaction = std::optional<SQLite::Transaction>();
+  auto inserted = size_t{0};
+  for (size_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index) {
+    auto const thread = chunk_index % threads;
+    auto item = queues[thread]->pop();
+    if (auto const error = std::get_if<std::exception_ptr>(&item))
+      std::rethrow_exception(*error);
+    for (auto const & message : std::get<Chunk>(item)) {
+      if (!transaction.has_value())
+        transaction.emplace(db);
+      insert_query.bind(1, static_cast<int64_t>(message.size()));
+      insert_query.bindNoCopy(2, message);
+      if (insert_query.exec() != 1)
+        throw make_exception<Exception>(
+          "Insertion failed at count: " + std::to_string(inserted) +
+          " for message with size: " + std::to_string(message.size())
+        );
+      insert_query.reset();
+      if (++inserted % std::max(options.transaction_rows, size_t{1}) == 0) {
+        transaction->commit();
+        transaction.reset();
+      }
+    }
   }
+  if (transaction.has_value())
+    transaction->commit();
+}
+
+ShardRanges SourceService::plan_shards(ShardRanges const & checkpoints) const {
+  if (!checkpoints.empty())
+    return checkpoints;
+
+  auto constexpr lowest = std::numeric_limits<int64_t>::min();
+  auto constexpr highest = std::numeric_limits<int64_t>::max();
+
+  auto db = SQLite::Database(dbfile_, SQLite::OPEN_READONLY);
+  auto query = SQLite::Statement(db, "SELECT MIN(id), MAX(id) FROM messages");
+  query.executeStep();
+  if (query.getColumn(0).isNull() || options_.shards <= 1)
+    return ShardRanges{IdRange{lowest, highest}};
+
+  auto const min_id = query.getColumn(0).getInt64();
+  auto const max_id = query.getColumn(1).getInt64();
+  auto const shards = static_cast<int64_t>(options_.shards);
+  auto const width = std::max<int64_t>((max_id - min_id) / shards + 1, 1);
+  auto ranges = ShardRanges();
+  for (int64_t i = 0; i < shards; ++i)
+    ranges.push_back(IdRange{
+      i == 0 ? lowest : min_id - 1 + i * width,
+      i == shards - 1 ? highest : min_id - 1 + (i + 1) * width
+    });
+  return ranges;
 }
 
-void SourceService::start(RecordCallback && cb, size_t log_frequency) {
+void SourceService::register_metrics(MetricsRegistry & registry) {
+  registry.add("source_records_out", metrics_.records_out);
+  registry.add("source_bytes_out", metrics_.bytes_out);
+}
+
+void SourceService::start(
+  RecordsCallback && cb,
+  size_t chunk_size,
+  size_t log_frequency,
+  ShardRanges const & shards
+) {
   using namespace std::placeholders;
-  start_thread(
-    std::bind(&SourceService::work_loop, this, _1, _2, _3),
+  start_threads(
+    shards.size(),
+    std::bind(&SourceService::work_loop, this, _1, _2, _3, _4, _5),
     std::move(cb),
-    log_frequency
+    chunk_size,
+    log_frequency,
+    shards
   );
 }
 
-void SourceService::work_loop(std::stop_token stop, RecordCallback && cb, size_t log_frequency) {
+void SourceService::work_loop(
+  std::stop_token stop,
+  RecordsCallback && cb,
+  size_t chunk_size,
+  size_t log_frequency,
+  ShardRanges const & shards
+) {
   //using namespace std::chrono_literals;
   //std::this_thread::sleep_for(1s);
-  log("SourceService: work_loop started");
-  auto db = SQLite::Database(dbfile_, SQLite::OPEN_READWRITE);
-  auto query = SQLite::Statement(db, "SELECT id, message FROM messages");
-  for (size_t i = 1; !stop.stop_requested() && query.executeStep(); ++i) {
-    cb(stop, Record{query.getColumn(0).getInt(), query.getColumn(1).getString()});
-    if (i % log_frequency == 0)
-      log("SourceService: read " + std::to_string(i) + " messages");
+  auto const shard = next_shard_++;
+  auto const & range = shards[shard];
+  log("SourceService[{}]: work_loop started", shard);
+  auto db = SQLite::Database(dbfile_, SQLite::OPEN_READONLY);
+  if (options_.mmap_bytes.has_value())
+    db.exec("PRAGMA mmap_size=" + std::to_string(*options_.mmap_bytes));
+  //large messages aren't selected but streamed separately via prehash_message
+  //size is only filled by populate, otherwise the stored length decides (octet_length doesn't
+  // load the message)
+  auto const large = std::string("COALESCE(size, octet_length(message)) > ?1");
+  //every page is a separate short read transaction that continues after the last seen id
+  auto query = SQLite::Statement(
+    db,
+    "SELECT id, " + large + ", CASE WHEN " + large + " THEN NULL ELSE message END " +
+    "FROM messages WHERE id > ?2 AND id <= ?3" +
+    (options_.skip_signed ? " AND signature IS NULL" : "") +
+    " ORDER BY id LIMIT ?4"
+  );
+  query.bind(
+    1,
+    static_cast<int64_t>(
+      options_.prehash_message_bytes.value_or(std::numeric_limits<int64_t>::max())
+    )
+  );
+  query.bind(3, range.end_id);
+  query.bind(4, static_cast<int64_t>(options_.page_size));
+
+  auto last_id = range.after_id;
+  auto sequence = size_t{0};
+  auto blob_buffer = std::vector<char>();
+  auto chunk = pools_->records.acquire();
+  chunk.reserve(chunk_size);
+  auto emit = [&]() {
+    auto bytes = size_t{0};
+    for (auto const & record : chunk)
+      bytes += record.message.size();
+    metrics_.records_out.add(chunk.size());
+    metrics_.bytes_out.add(bytes);
+    cb(stop, std::move(chunk));
+  };
+
+  auto page_rows = options_.page_size;
+  while (!stop.stop_requested() && page_rows == options_.page_size) {
+    query.bind(2, last_id);
+    for (page_rows = 0; !stop.stop_requested() && query.executeStep(); ++page_rows) {
+      auto const id = query.getColumn(0).getInt();
+      last_id = id;
+      auto message = pools_->messages.acquire();
+      auto const prehashed = query.getColumn(1).getInt() != 0;
+      if (prehashed)
+        prehash_message(db, id, blob_buffer, message);
+      else {
+        auto const column = query.getColumn(2);
+        message.assign(column.getText(), static_cast<size_t>(column.getBytes()));
+      }
+      chunk.push_back(Record{id, std::move(message), prehashed, sequence, shard});
+      ++sequence;
+      if (chunk.size() == chunk_size) {
+        emit();
+        chunk = pools_->records.acquire();
+        chunk.reserve(chunk_size);
+      }
+      if (sequence % log_frequency == 0)
+        log("SourceService[{}]: read {} messages", shard, sequence);
+    }
+    query.reset();
   }
-  log("SourceService: work_loop ended");
-}
\ No newline at end of file
+  if (!chunk.empty() && !stop.stop_requested())
+    emit();
+  log("SourceService[{}]: work_loop ended", shard);
+}
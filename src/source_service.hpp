@@ -1,30 +1,95 @@
 #ifndef SOURCE_SERVICE_HPP
 #define SOURCE_SERVICE_HPP
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
 
+#include "buffer_pool.hpp"
 #include "common.hpp"
+#include "metrics.hpp"
 #include "microservice.hpp"
 #include "record_types.hpp"
 
 class SourceService : public Microservice {
   public:
-    //maximum entropy of a random message (about 100MB - sqlite has an upper limit of ~1GB)
-    auto static constexpr max_random_message_bytes = 1e8;
+    //records are handed over in chunks to amortize queue synchronization
+    using RecordsCallback = std::function<void (std::stop_token, std::vector<Record>)>;
 
-    using RecordCallback = std::function<void (std::stop_token, Record)>;
+    struct Options {
+      //messages larger than this are never loaded into memory but streamed from the db into a
+      // SHA-512 digest in chunks, which is then signed instead (see Key::sign_prehashed)
+      std::optional<size_t> prehash_message_bytes;
+      //only select messages without a signature (see SinkService::Mode::update_messages)
+      bool skip_signed = false;
+      //messages are read in id order in pages of this size (keyset pagination)
+      size_t page_size = 1000;
+      //number of reader threads (each with its own read-only connection) scanning disjoint
+      // id ranges (see plan_shards)
+      size_t shards = 1;
+      //PRAGMA mmap_size of the reader connections (nullopt = sqlite default)
+      std::optional<int64_t> mmap_bytes = int64_t{1} << 30;
+    };
 
+    //creates the messages table if necessary, including the signature/signer columns which
+    // are added to pre-existing tables as well
     SourceService(std::string const & dbfile);
+    SourceService(std::string const & dbfile, Options const & options);
+
+    struct PopulateOptions {
+      //same seed and count always produce the same table (given it was empty before)
+      std::optional<std::uint64_t> seed;
+      //generator threads (0 = hardware concurrency)
+      size_t threads = 0;
+      //messages are generated in chunks of this many rows, each from its own seed
+      size_t chunk_rows = 1000;
+      //rows inserted per transaction by the single writer
+      size_t transaction_rows = 100000;
+    };
 
     bool is_empty() const;
+    //appends count random messages (see MessageGenerator)
     void populate(size_t count);
+    void populate(size_t count, PopulateOptions const & options);
+
+    //returns checkpoints as is if there are any (i.e. resumes with the same shards), otherwise
+    // splits [MIN(id), MAX(id)] into Options::shards equally wide ranges (last one is open-ended)
+    ShardRanges plan_shards(ShardRanges const & checkpoints) const;
+
+    //runs one reader thread per shard
+    void start(
+      RecordsCallback && cb,
+      size_t chunk_size,
+      size_t log_frequency,
+      ShardRanges const & shards
+    );
 
-    void start(RecordCallback && cb, size_t log_frequency);
+    void register_metrics(MetricsRegistry & registry) override;
+
+    //takes its record vectors and message strings from the pools
+    void share_buffer_pools(std::shared_ptr<BufferPools> pools) {pools_ = std::move(pools);}
   
   private:
-    void work_loop(std::stop_token stop, RecordCallback && cb, size_t log_frequency);
+    struct Metrics {
+      Counter records_out;
+      Counter bytes_out; //message bytes as read (digest bytes for prehashed messages)
+    };
+
+    void work_loop(
+      std::stop_token stop,
+      RecordsCallback && cb,
+      size_t chunk_size,
+      size_t log_frequency,
+      ShardRanges const & shards
+    );
 
     std::string dbfile_;
+    Options options_;
+    std::atomic<size_t> next_shard_;
+    Metrics metrics_;
+    std::shared_ptr<BufferPools> pools_;
 };
 
 #endif
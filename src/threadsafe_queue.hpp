@@ -1,8 +1,14 @@
 #ifndef THREADSAFE_QUEUE_HPP
 #define THREADSAFE_QUEUE_HPP
 
+#include <algorithm>
+#include <limits>
 #include <queue>
+#include <type_traits>
+#include <vector>
 #include <mutex>
+#include <chrono>
+#include <optional>
 #include <condition_variable>
 #include <stop_token>
 
@@ -10,13 +16,17 @@
 
 struct OutOfCapacity : public virtual Exception {};
 struct StopRequested : public virtual Exception {};
+//end of stream: the queue was closed and is drained (or a push happened after close)
+struct QueueClosed : public virtual Exception {};
+
+using Deadline = std::optional<std::chrono::steady_clock::time_point>;
 
 template <typename>
 struct DiscardOnNoCapacity {
   using PushGuard = std::scoped_lock<std::mutex>;
 
   template <typename... args>
-  bool on_at_capacity(args...) {
+  bool on_at_capacity(args &&...) {
     return false;
   }
 
@@ -32,7 +42,7 @@ struct ThrowOnNoCapacity {
   using PushGuard = std::scoped_lock<std::mutex>;
 
   template <typename... args>
-  bool on_at_capacity(args...) {
+  bool on_at_capacity(args &&...) {
     throw make_exception<OutOfCapacity>("Out of capacity");
   }
 
@@ -48,24 +58,31 @@ struct WaitUntilCapacityAvailable
 {
   using PushGuard = std::unique_lock<std::mutex>;
 
+  template <typename HasCapacityT>
   bool on_at_capacity(
     std::unique_lock<std::mutex> & lock,
     std::condition_variable_any & cond,
-    std::queue<T> & items,
-    size_t capacity
+    HasCapacityT && has_capacity
   ) {
-    cond.wait(lock, [&]() {return items.size() < capacity;});
+    cond.wait(lock, has_capacity);
     return true;
   }
 
+  template <typename HasCapacityT>
   bool on_at_capacity(
     std::stop_token stop,
     std::unique_lock<std::mutex> & lock,
     std::condition_variable_any & cond,
-    std::queue<T> & items,
-    size_t capacity
+    HasCapacityT && has_capacity
   ) {
-    cond.wait(lock, stop, [&]() {return items.size() < capacity;});
+    cond.wait(lock, stop, has_capacity);
+    return true;
+  }
+
+  //for queues that manage their own waiting (e.g. RingBufferQueue)
+  template <typename WaitFuncT>
+  bool on_at_capacity(WaitFuncT && wait_for_capacity) {
+    wait_for_capacity();
     return true;
   }
 
@@ -78,65 +95,166 @@ struct WaitUntilCapacityAvailable
   }
 };
 
+//measures of how much of a ThreadsafeQueue's capacity an item takes up
+
+//capacity is a number of items
+struct CountItems {
+  template <typename T>
+  size_t operator()(T const &) const {return 1;}
+};
+
+//capacity is a number of bytes, T::byte_size() must be cheap and must not change while queued
+struct CountBytes {
+  template <typename T>
+  size_t operator()(T const & item) const {return item.byte_size();}
+};
+
 //rather incomplete ThreadsafeQueue class
-// - no timed waiting
+// - timed waiting only for pop_n
+// - close() signals end of stream: consumers drain what's left and then get QueueClosed
 // - could have try_pop returning std::optional
+// - capacity is in units of MeasureT (e.g. CountBytes for a memory ceiling), an item larger than
+//   the whole capacity is still admitted into an empty queue so it can't block forever
 template <
   typename T,
-  template<class> typename AtMaxCapacityPolicy = WaitUntilCapacityAvailable
+  template<class> typename AtMaxCapacityPolicy = WaitUntilCapacityAvailable,
+  typename MeasureT = CountItems
 >
 class ThreadsafeQueue : public AtMaxCapacityPolicy<T>
 {
+  static bool constexpr waits_on_capacity =
+    std::is_same_v<AtMaxCapacityPolicy<T>, WaitUntilCapacityAvailable<T>>;
+
   public:
     ThreadsafeQueue(size_t capacity) : capacity_{capacity} {}
     //can't be safely destroyed while in use given current impl
     //implicit move/copy ctors/assignments rightfully implicitly deleted because of mutex member
 
+    //all pushes must have completed before close is called, pushing afterwards throws
+    void close() {
+      {
+        auto lock = std::scoped_lock{mut_};
+        closed_ = true;
+      }
+      cond_.notify_all();
+    }
+
     void push(T && item) {
+      auto const units = measure_(item);
       {
         auto lock = typename AtMaxCapacityPolicy<T>::PushGuard{mut_};
-        if (items_.size() == capacity_)
-          if (!this->on_at_capacity(lock, cond_, items_, capacity_))
+        throw_if_closed();
+        if (!has_capacity(units))
+          if (!this->on_at_capacity(lock, cond_, [&]() {return has_capacity(units);}))
             return;
-        items_.push(std::move(item));
+        push_locked(std::move(item), units);
       }
       this->on_push(cond_);
     }
 
-    std::enable_if_t<std::is_same_v<AtMaxCapacityPolicy<T>, WaitUntilCapacityAvailable<T>>>
-    push(std::stop_token stop, T && item) {
+    void push(std::stop_token stop, T && item) requires waits_on_capacity {
+      auto const units = measure_(item);
       {
         auto lock = typename AtMaxCapacityPolicy<T>::PushGuard{mut_};
-        if (items_.size() == capacity_)
-          this->on_at_capacity(stop, lock, cond_, items_, capacity_);
+        throw_if_closed();
+        if (!has_capacity(units))
+          this->on_at_capacity(stop, lock, cond_, [&]() {return has_capacity(units);});
         if (stop.stop_requested())
           return;
-        items_.push(std::move(item));
+        push_locked(std::move(item), units);
       }
       this->on_push(cond_);
     }
 
+    //moves [first, last) into the queue, transferring as many items as fit per lock acquisition
+    template <typename IterT>
+    void push_n(std::stop_token stop, IterT first, IterT last) requires waits_on_capacity {
+      while (first != last) {
+        {
+          auto lock = typename AtMaxCapacityPolicy<T>::PushGuard{mut_};
+          throw_if_closed();
+          auto units = measure_(*first);
+          if (!has_capacity(units))
+            this->on_at_capacity(stop, lock, cond_, [&]() {return has_capacity(units);});
+          if (stop.stop_requested())
+            return;
+          while (true) {
+            push_locked(std::move(*first), units);
+            if (++first == last)
+              break;
+            units = measure_(*first);
+            if (!has_capacity(units))
+              break;
+          }
+        }
+        this->on_push(cond_);
+      }
+    }
+
+    //appends up to count items to items, taking everything available per lock acquisition
+    //without a deadline it blocks until count items were popped, otherwise it returns early once
+    // the deadline has passed
+    //it also returns early once the next item would take the popped units past max_units (but
+    // always pops at least one item)
+    //returns the number of popped items
+    //once closed and drained it returns what it got so far, or throws QueueClosed if that's nothing
+    size_t pop_n(
+      std::stop_token stop,
+      std::vector<T> & items,
+      size_t count,
+      Deadline deadline = std::nullopt,
+      size_t max_units = std::numeric_limits<size_t>::max()
+    ) {
+      auto popped = size_t{0};
+      auto popped_units = size_t{0};
+      auto full = false;
+      while (popped < count && !full) {
+        {
+          auto lock = std::unique_lock{mut_};
+          auto not_empty = [&]() {return !items_.empty() || closed_;};
+          if (deadline.has_value())
+            cond_.wait_until(lock, stop, *deadline, not_empty);
+          else
+            cond_.wait(lock, stop, not_empty);
+          if (stop.stop_requested())
+            throw make_exception<StopRequested>("");
+          if (items_.empty() && closed_ && popped == 0)
+            throw make_exception<QueueClosed>("");
+          if (items_.empty()) //deadline passed or closed
+            return popped;
+          for (; popped < count && !items_.empty(); ++popped) {
+            auto const units = measure_(items_.front());
+            if (popped != 0 && units > max_units - std::min(popped_units, max_units)) {
+              full = true;
+              break;
+            }
+            popped_units += units;
+            used_ -= units;
+            items.emplace_back(std::move(items_.front()));
+            items_.pop();
+          }
+        }
+        this->on_pop(cond_);
+      }
+      return popped;
+    }
+
+    //throws QueueClosed once closed and drained
     T pop() {
-      auto locked_part = [&]() {
-        auto lock = std::unique_lock{mut_};
-        cond_.wait(lock, [&]() {return !items_.empty();});
-        auto item = std::move(items_.front());
-        items_.pop();
-        return item;
-      };
-      auto item = locked_part();
-      this->on_pop(cond_);
-      return item;
+      return pop(std::stop_token());
     }
 
     T pop(std::stop_token stop) {
       auto locked_part = [&]() {
         auto lock = std::unique_lock{mut_};
-        cond_.wait(lock, stop, [&]() {return !items_.empty();});
+        cond_.wait(lock, stop, [&]() {return !items_.empty() || closed_;});
         if (stop.stop_requested())
           throw make_exception<StopRequested>("");
+        if (items_.empty())
+          throw make_exception<QueueClosed>("");
         auto item = std::move(items_.front());
         items_.pop();
+        used_ -= measure_(item);
         return item;
       };
       auto item = locked_part();
@@ -154,11 +272,37 @@ class ThreadsafeQueue : public AtMaxCapacityPolicy<T>
       return items_.size();
     }
 
+    //in units of MeasureT
+    auto used() const {
+      auto lock = std::scoped_lock{mut_};
+      return used_;
+    }
+
   private:
+    //mut_ must be held
+    bool has_capacity(size_t units) const {
+      return items_.empty() || units <= capacity_ - std::min(used_, capacity_);
+    }
+
+    //mut_ must be held
+    void push_locked(T && item, size_t units) {
+      items_.push(std::move(item));
+      used_ += units;
+    }
+
+    //mut_ must be held
+    void throw_if_closed() const {
+      if (closed_)
+        throw make_exception<QueueClosed>("push after close");
+    }
+
     size_t capacity_;
     std::mutex mutable mut_;
     std::condition_variable_any cond_;
     std::queue<T> items_;
+    size_t used_ = 0;
+    [[no_unique_address]] MeasureT measure_;
+    bool closed_ = false;
 };
 
 #endif
@@ -0,0 +1,89 @@
+#include "verify.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/donna.h>
+
+namespace {
+  //DER prefix of an X.509 SubjectPublicKeyInfo holding an Ed25519 key (RFC 8410)
+  auto constexpr x509_ed25519_prefix = std::array<std::uint8_t, 12>{
+    0x30, 0x2A, 0x30, 0x05, 0x06, 0x03, 0x2B, 0x65, 0x70, 0x03, 0x21, 0x00
+  };
+  static_assert(x509_ed25519_prefix.size() + raw_public_key_bytes == public_key_bytes);
+}
+
+RawPublicKey decode_public_key(std::span<std::byte const> encoded) {
+  if (encoded.size() != public_key_bytes)
+    throw make_exception<InvalidPublicKey>(
+      "unexpected public key size: " + std::to_string(encoded.size())
+    );
+  if (!std::equal(
+    x509_ed25519_prefix.begin(),
+    x509_ed25519_prefix.end(),
+    encoded.begin(),
+    [](auto expected, auto actual) {return expected == static_cast<std::uint8_t>(actual);}
+  ))
+    throw make_exception<InvalidPublicKey>("not an X.509 encoded Ed25519 public key");
+
+  auto public_key = RawPublicKey();
+  std::copy(encoded.begin() + x509_ed25519_prefix.size(), encoded.end(), public_key.begin());
+  return public_key;
+}
+
+std::array<std::byte, public_key_bytes> encode_public_key(RawPublicKey const & public_key) {
+  auto encoded = std::array<std::byte, public_key_bytes>();
+  auto const out = std::transform(
+    x509_ed25519_prefix.begin(),
+    x509_ed25519_prefix.end(),
+    encoded.begin(),
+    [](auto b) {return static_cast<std::byte>(b);}
+  );
+  std::copy(public_key.begin(), public_key.end(), out);
+  return encoded;
+}
+
+bool verify_signature(
+  RawPublicKey const & public_key,
+  std::string_view message,
+  Signature const & signature
+) {
+  return CryptoPP::Donna::ed25519_sign_open(
+    reinterpret_cast<CryptoPP::byte const *>(message.data()),
+    message.size(),
+    reinterpret_cast<CryptoPP::byte const *>(public_key.data()),
+    reinterpret_cast<CryptoPP::byte const *>(signature.data())
+  ) == 0;
+}
+
+bool verify_prehashed(
+  RawPublicKey const & public_key,
+  std::string_view digest,
+  Signature const & signature
+) {
+  if (digest.size() != prehash_digest_bytes)
+    return false;
+  auto const message = prehashed_message(digest);
+  return verify_signature(public_key, std::string_view(message.data(), message.size()), signature);
+}
+
+bool verify_merkle(
+  RawPublicKey const & public_key,
+  std::string_view message,
+  bool prehashed,
+  MerkleProof const & proof,
+  Signature const & root_signature
+) {
+  if (prehashed && message.size() != prehash_digest_bytes)
+    return false;
+  auto const root = merkle_root(merkle_leaf_hash(message, prehashed), proof);
+  if (!root.has_value())
+    return false;
+  auto const root_message = merkle_root_message(*root, proof.leaf_count);
+  return verify_signature(
+    public_key,
+    std::string_view(root_message.data(), root_message.size()),
+    root_signature
+  );
+}
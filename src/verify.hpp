@@ -0,0 +1,72 @@
+#ifndef VERIFY_HPP
+#define VERIFY_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "common.hpp"
+#include "crypto_sizes.hpp"
+#include "merkle.hpp"
+
+//what actually gets signed, and verification with nothing but a public key (see Key for signing)
+
+//prefixed to SHA-512 digests before signing them to separate them from regular messages
+//(CryptoPP doesn't expose RFC 8032 Ed25519ph, so we can't put it into dom2 where it belongs)
+auto constexpr prehash_context = std::string_view("SigEd25519 no Ed25519 collisions\x01\x00", 34);
+//prefixed to merkle roots (followed by the leaf count) before signing them, for the same reason
+auto constexpr merkle_root_context = std::string_view("SigEd25519 merkle root\x00", 23);
+
+struct InvalidPublicKey : public virtual Exception {};
+
+//prehash_context || digest on the stack
+inline auto prehashed_message(std::string_view digest) {
+  if (digest.size() != prehash_digest_bytes)
+    throw make_exception<Exception>("unexpected digest size: " + std::to_string(digest.size()));
+  auto message = std::array<char, prehash_context.size() + prehash_digest_bytes>();
+  std::copy(prehash_context.begin(), prehash_context.end(), message.begin());
+  std::copy(digest.begin(), digest.end(), message.begin() + prehash_context.size());
+  return message;
+}
+
+//merkle_root_context || root || leaf_count (little endian) on the stack
+inline auto merkle_root_message(MerkleHash const & root, std::uint32_t leaf_count) {
+  auto message = std::array<char, merkle_root_context.size() + merkle_hash_bytes + 4>();
+  auto out = std::copy(merkle_root_context.begin(), merkle_root_context.end(), message.begin());
+  out = std::transform(root.begin(), root.end(), out, [](auto b) {return static_cast<char>(b);});
+  for (auto shift = 0; shift < 32; shift += 8)
+    *out++ = static_cast<char>(leaf_count >> shift);
+  return message;
+}
+
+//from the X.509 encoding of KeyService::public_key (the raw key is its tail), throws
+// InvalidPublicKey
+RawPublicKey decode_public_key(std::span<std::byte const> encoded);
+std::array<std::byte, public_key_bytes> encode_public_key(RawPublicKey const & public_key);
+
+bool verify_signature(
+  RawPublicKey const & public_key,
+  std::string_view message,
+  Signature const & signature
+);
+
+//digest = SHA-512(message), false if it isn't a SHA-512 digest
+bool verify_prehashed(
+  RawPublicKey const & public_key,
+  std::string_view digest,
+  Signature const & signature
+);
+
+//message is the digest for prehashed records
+bool verify_merkle(
+  RawPublicKey const & public_key,
+  std::string_view message,
+  bool prehashed,
+  MerkleProof const & proof,
+  Signature const & root_signature
+);
+
+#endif
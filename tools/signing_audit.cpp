@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/sha.h>
+
+#include "common.hpp"
+#include "crypto_sizes.hpp"
+#include "hex.hpp"
+#include "merkle.hpp"
+#include "record_types.hpp"
+#include "verify.hpp"
+
+//re-verifies every signature written by SinkService against the messages they were made for,
+// using nothing but the stored public keys
+//works for both sink modes (a separate signed db or signatures in the messages table) and both
+// formats (hex or binary), and for per-record as well as merkle root signatures
+//usage: signing_audit [--allow-unsigned] [messages_db] [signed_db, - if signed in place] [threads]
+//                      [prehash_bytes]
+//whether a record was prehashed is read from the stored prehashed column, prehash_bytes
+// (SourceService::Options::prehash_message_bytes of the signing run) is only needed for rows
+// written before that column existed
+//exits with EXIT_FAILURE if any signature doesn't verify or any message has no signature, the
+// latter is accepted with --allow-unsigned (e.g. for a partially signed in-place db)
+
+namespace {
+  struct AuditOptions {
+    std::string messages_db = "messages.db";
+    std::optional<std::string> signed_db;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    //fallback for rows without a stored prehashed flag
+    int64_t prehash_message_bytes = int64_t{1} << 20;
+    //rows per keyset page, every page is a separate short read transaction
+    size_t page_size = 1000;
+    //id ranges per thread, claimed dynamically to balance uneven message sizes
+    size_t ranges_per_thread = 8;
+    size_t max_reported_failures = 20;
+    bool allow_unsigned = false;
+  };
+
+  AuditOptions parse_options(int argc, char ** argv) {
+    auto options = AuditOptions();
+    auto args = std::vector<std::string>();
+    for (int i = 1; i < argc; ++i) {
+      if (std::string(argv[i]) == "--allow-unsigned")
+        options.allow_unsigned = true;
+      else
+        args.emplace_back(argv[i]);
+    }
+    if (args.size() > 0) options.messages_db = args[0];
+    if (args.size() > 1 && args[1] != "-") options.signed_db = args[1];
+    if (args.size() > 2) options.threads = std::stoull(args[2]);
+    if (args.size() > 3) options.prehash_message_bytes = std::stoll(args[3]);
+    return options;
+  }
+
+  struct Totals {
+    std::atomic<size_t> rows = 0;
+    std::atomic<size_t> verified = 0;
+    std::atomic<size_t> failed = 0;
+    std::atomic<size_t> unsigned_rows = 0;
+    //signature verifications that were saved because consecutive records share a merkle root
+    std::atomic<size_t> merkle_roots_reused = 0;
+  };
+
+  struct Failure {
+    int64_t id;
+    std::string reason;
+  };
+
+  class Auditor {
+    public:
+      Auditor(AuditOptions const & options) : options_(options) {}
+
+      //throws the first error a worker ran into outside of verifying a row (e.g. a locked db)
+      void run() {
+        plan_ranges();
+        load_signers();
+        //prepared here once so that schema errors surface on this thread
+        auto const sql = [&]() {
+          auto db = open();
+          auto sql = select_query(db);
+          SQLite::Statement(db, sql);
+          return sql;
+        }();
+        {
+          auto workers = std::vector<std::jthread>();
+          for (size_t i = 0; i < options_.threads; ++i)
+            workers.emplace_back([this, &sql]() {work_loop(sql);});
+        }
+        if (error_)
+          std::rethrow_exception(error_);
+      }
+
+      Totals const & totals() const {return totals_;}
+      std::vector<Failure> const & failures() const {return failures_;}
+
+    private:
+      //verifications of the same merkle root are skipped (records of a batch are consecutive)
+      struct VerifiedRoot {
+        RawPublicKey public_key;
+        MerkleHash root;
+        std::uint32_t leaf_count;
+        Signature signature;
+
+        bool operator==(VerifiedRoot const &) const = default;
+      };
+
+      SQLite::Database open() const {
+        auto db = SQLite::Database(options_.messages_db, SQLite::OPEN_READONLY);
+        if (options_.signed_db.has_value()) {
+          auto attach = SQLite::Statement(db, "ATTACH DATABASE ? AS signed_db");
+          attach.bind(1, *options_.signed_db);
+          attach.exec();
+        }
+        return db;
+      }
+
+      //the schema holding the signatures and (binary format) the signers table
+      std::string signed_schema() const {
+        return options_.signed_db.has_value() ? "signed_db" : "main";
+      }
+
+      void plan_ranges() {
+        auto constexpr lowest = std::numeric_limits<int64_t>::min();
+        auto constexpr highest = std::numeric_limits<int64_t>::max();
+
+        auto db = open();
+        auto query = SQLite::Statement(db, "SELECT MIN(id), MAX(id) FROM messages");
+        query.executeStep();
+        auto const count = static_cast<int64_t>(options_.threads * options_.ranges_per_thread);
+        if (query.getColumn(0).isNull() || count <= 1) {
+          ranges_.push_back(IdRange{lowest, highest});
+          return;
+        }
+
+        auto const min_id = query.getColumn(0).getInt64();
+        auto const max_id = query.getColumn(1).getInt64();
+        auto const width = std::max<int64_t>((max_id - min_id) / count + 1, 1);
+        for (int64_t i = 0; i < count; ++i)
+          ranges_.push_back(IdRange{
+            i == 0 ? lowest : min_id - 1 + i * width,
+            i == count - 1 ? highest : min_id - 1 + (i + 1) * width
+          });
+      }
+
+      //binary format only
+      void load_signers() {
+        auto db = open();
+        auto exists = SQLite::Statement(
+          db,
+          "SELECT COUNT(*) FROM " + signed_schema() + ".sqlite_master WHERE name = 'signers'"
+        );
+        exists.executeStep();
+        if (exists.getColumn(0).getInt() == 0)
+          return;
+
+        auto query = SQLite::Statement(
+          db,
+          "SELECT id, public_key FROM " + signed_schema() + ".signers"
+        );
+        while (query.executeStep()) {
+          auto const column = query.getColumn(1);
+          signers_.emplace(
+            query.getColumn(0).getInt64(),
+            decode_public_key(std::span(
+              static_cast<std::byte const *>(column.getBlob()),
+              static_cast<size_t>(column.getBytes())
+            ))
+          );
+        }
+      }
+
+      //of the table holding the signatures
+      bool column_exists(SQLite::Database & db, std::string const & column) const {
+        auto query = SQLite::Statement(
+          db,
+          "SELECT COUNT(*) FROM pragma_table_info('" +
+          std::string(options_.signed_db.has_value() ? "signed" : "messages") +
+          "', '" + signed_schema() + "') WHERE name = ?"
+        );
+        query.bind(1, column);
+        query.executeStep();
+        return query.getColumn(0).getInt() != 0;
+      }
+
+      std::string select_query(SQLite::Database & db) const {
+        auto const source = options_.signed_db.has_value()
+          ? std::string("messages m LEFT JOIN signed_db.signed s USING (id)")
+          : std::string("messages m");
+        auto const signed_alias = std::string(options_.signed_db.has_value() ? "s." : "m.");
+        //messages of other runs may predate merkle proofs and stored prehashed flags
+        auto const proof =
+          column_exists(db, "proof") ? signed_alias + "proof" : std::string("NULL");
+        auto const prehashed = column_exists(db, "prehashed")
+          ? "COALESCE(" + signed_alias + "prehashed, m.size > ?1)"
+          : std::string("m.size > ?1");
+        return
+          "SELECT m.id, " + prehashed + ", m.message, " +
+          signed_alias + "signature, " + signed_alias + "signer, " + proof +
+          " FROM " + source + " WHERE m.id > ?2 AND m.id <= ?3 ORDER BY m.id LIMIT ?4";
+      }
+
+      void work_loop(std::string const & sql) {
+        try {
+          audit_ranges(sql);
+        }
+        catch (...) {
+          auto lock = std::scoped_lock(failures_mut_);
+          if (!error_)
+            error_ = std::current_exception();
+          //the others stop after their current range
+          next_range_.store(ranges_.size());
+        }
+      }
+
+      void audit_ranges(std::string const & sql) {
+        auto db = open();
+        auto query = SQLite::Statement(db, sql);
+        query.bind(1, options_.prehash_message_bytes);
+        query.bind(4, static_cast<int64_t>(options_.page_size));
+
+        auto hex_signers = std::unordered_map<std::string, RawPublicKey>();
+        auto digest = std::string(prehash_digest_bytes, '\0');
+        auto bytes = std::vector<std::byte>();
+        auto last_root = std::optional<VerifiedRoot>();
+
+        for (auto index = next_range_++; index < ranges_.size(); index = next_range_++) {
+          auto const range = ranges_[index];
+          query.bind(3, range.end_id);
+          auto last_id = range.after_id;
+          auto page_rows = size_t{0};
+          do {
+            query.bind(2, last_id);
+            page_rows = 0;
+            while (query.executeStep()) {
+              ++page_rows;
+              last_id = query.getColumn(0).getInt64();
+              totals_.rows.fetch_add(1, std::memory_order_relaxed);
+              if (query.getColumn(3).isNull()) {
+                totals_.unsigned_rows.fetch_add(1, std::memory_order_relaxed);
+                continue;
+              }
+              try {
+                audit_row(query, hex_signers, digest, bytes, last_root);
+                totals_.verified.fetch_add(1, std::memory_order_relaxed);
+              }
+              catch (std::exception const & e) {
+                fail(last_id, e.what());
+              }
+            }
+            query.reset();
+          } while (page_rows == options_.page_size);
+        }
+      }
+
+      //throws on failure
+      void audit_row(
+        SQLite::Statement const & query,
+        std::unordered_map<std::string, RawPublicKey> & hex_signers,
+        std::string & digest,
+        std::vector<std::byte> & bytes,
+        std::optional<VerifiedRoot> & last_root
+      ) {
+        auto const prehashed = query.getColumn(1).getInt() != 0;
+        auto const message_column = query.getColumn(2);
+        auto message = std::string_view(
+          static_cast<char const *>(message_column.getBlob()),
+          static_cast<size_t>(message_column.getBytes())
+        );
+        if (prehashed) {
+          auto hash = CryptoPP::SHA512();
+          hash.Update(reinterpret_cast<CryptoPP::byte const *>(message.data()), message.size());
+          hash.Final(reinterpret_cast<CryptoPP::byte *>(digest.data()));
+          message = digest;
+        }
+
+        auto const signature = [&]() {
+          auto signature = Signature();
+          read_bytes(query.getColumn(3), bytes);
+          if (bytes.size() != signature.size())
+            throw make_exception<Exception>("unexpected signature size");
+          std::copy(bytes.begin(), bytes.end(), signature.begin());
+          return signature;
+        }();
+
+        auto const public_key = [&]() {
+          auto const signer = query.getColumn(4);
+          if (signer.isInteger()) {
+            auto const it = signers_.find(signer.getInt64());
+            if (it == signers_.end())
+              throw make_exception<Exception>(
+                "unknown signer: " + std::to_string(signer.getInt64())
+              );
+            return it->second;
+          }
+          auto const hex = signer.getString();
+          auto it = hex_signers.find(hex);
+          if (it == hex_signers.end()) {
+            auto encoded = std::array<std::byte, public_key_bytes>();
+            from_hex(hex, encoded);
+            it = hex_signers.emplace(hex, decode_public_key(encoded)).first;
+          }
+          return it->second;
+        }();
+
+        if (query.getColumn(5).isNull()) {
+          auto const valid = prehashed
+            ? verify_prehashed(public_key, message, signature)
+            : verify_signature(public_key, message, signature);
+          if (!valid)
+            throw make_exception<Exception>("invalid signature");
+          return;
+        }
+
+        read_bytes(query.getColumn(5), bytes);
+        auto const proof = decode_merkle_proof(bytes);
+        auto const root = merkle_root(merkle_leaf_hash(message, prehashed), proof);
+        if (!root.has_value())
+          throw make_exception<Exception>("malformed merkle proof");
+        auto verified_root = VerifiedRoot{public_key, *root, proof.leaf_count, signature};
+        if (last_root == verified_root) {
+          totals_.merkle_roots_reused.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        auto const root_message = merkle_root_message(*root, proof.leaf_count);
+        if (!verify_signature(
+          public_key,
+          std::string_view(root_message.data(), root_message.size()),
+          signature
+        ))
+          throw make_exception<Exception>("invalid merkle root signature");
+        last_root = verified_root;
+      }
+
+      //blobs as they are, text (hex format) decoded
+      static void read_bytes(SQLite::Column const & column, std::vector<std::byte> & bytes) {
+        if (column.isText()) {
+          auto const hex =
+            std::string_view(column.getText(), static_cast<size_t>(column.getBytes()));
+          bytes.resize(hex.size() / hex_digits_per_byte);
+          from_hex(hex, bytes);
+        }
+        else {
+          auto const data = static_cast<std::byte const *>(column.getBlob());
+          bytes.assign(data, data + column.getBytes());
+        }
+      }
+
+      void fail(int64_t id, std::string reason) {
+        totals_.failed.fetch_add(1, std::memory_order_relaxed);
+        auto lock = std::scoped_lock(failures_mut_);
+        if (failures_.size() < options_.max_reported_failures)
+          failures_.push_back(Failure{id, std::move(reason)});
+      }
+
+      AuditOptions options_;
+      ShardRanges ranges_;
+      std::atomic<size_t> next_range_ = 0;
+      //binary format: signers table id -> key
+      std::map<int64_t, RawPublicKey> signers_;
+      Totals totals_;
+      std::mutex failures_mut_;
+      std::vector<Failure> failures_;
+      //guarded by failures_mut_
+      std::exception_ptr error_;
+  };
+}
+
+int main(int argc, char ** argv) {
+  try {
+    using Clock = std::chrono::steady_clock;
+    auto const options = parse_options(argc, argv);
+
+    auto auditor = Auditor(options);
+    auto const start = Clock::now();
+    auditor.run();
+    auto const seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto const & totals = auditor.totals();
+    std::cout
+      << "{\n"
+      << "  \"threads\": " << options.threads << ",\n"
+      << "  \"seconds\": " << seconds << ",\n"
+      << "  \"rows\": " << totals.rows << ",\n"
+      << "  \"rows_per_sec\": " << static_cast<double>(totals.rows) / seconds << ",\n"
+      << "  \"verified\": " << totals.verified << ",\n"
+      << "  \"failed\": " << totals.failed << ",\n"
+      << "  \"unsigned\": " << totals.unsigned_rows << ",\n"
+      << "  \"merkle_roots_reused\": " << totals.merkle_roots_reused << "\n"
+      << "}" << std::endl;
+    for (auto const & failure : auditor.failures())
+      std::cerr << "failed: id " << failure.id << ": " << failure.reason << std::endl;
+
+    //e.g. rows the sink dropped
+    if (totals.unsigned_rows > 0 && !options.allow_unsigned) {
+      std::cerr << "failed: " << totals.unsigned_rows << " unsigned messages" << std::endl;
+      return EXIT_FAILURE;
+    }
+    return totals.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  catch (std::exception const & e) {
+    std::cout << "caught fatal exception: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}